@@ -0,0 +1,241 @@
+/*
+ * gobject-list-bench: microbenchmarks for the overhead of gobject-list hooks
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Each benchmark runs a tight loop of one operation in @n_threads threads at
+ * once and prints one line of space-separated key=value pairs, which stays
+ * stable across versions so that results can be compared mechanically:
+ *
+ *   bench=object-new threads=4 iterations=1000000 ns_per_op=… ops_per_s=…
+ *
+ * ns_per_op is the wall clock time of one operation as seen by one thread.
+ * Run it with and without LD_PRELOAD=libgobject-list.so; see run-bench.sh. */
+
+#include <glib-object.h>
+#include <gst/gst.h>
+
+#include <stdlib.h>
+
+typedef struct
+{
+  GObject parent;
+} BenchObject;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} BenchObjectClass;
+
+GType bench_object_get_type (void);
+
+G_DEFINE_TYPE (BenchObject, bench_object, G_TYPE_OBJECT)
+
+static void
+bench_object_class_init (G_GNUC_UNUSED BenchObjectClass *klass)
+{
+}
+
+static void
+bench_object_init (G_GNUC_UNUSED BenchObject *self)
+{
+}
+
+typedef void (*BenchFunc) (guint iterations);
+
+static void
+bench_object_new (guint iterations)
+{
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    g_object_unref (g_object_new (bench_object_get_type (), NULL));
+}
+
+static void
+bench_object_ref (guint iterations)
+{
+  GObject *obj = g_object_new (bench_object_get_type (), NULL);
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_object_ref (obj);
+      g_object_unref (obj);
+    }
+
+  g_object_unref (obj);
+}
+
+static void
+bench_buffer_new (guint iterations)
+{
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    gst_buffer_unref (gst_buffer_new ());
+}
+
+static void
+bench_mini_object_ref (guint iterations)
+{
+  GstBuffer *buffer = gst_buffer_new ();
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      gst_mini_object_ref (GST_MINI_OBJECT_CAST (buffer));
+      gst_mini_object_unref (GST_MINI_OBJECT_CAST (buffer));
+    }
+
+  gst_buffer_unref (buffer);
+}
+
+typedef struct
+{
+  const gchar *name;
+  BenchFunc func;
+} Bench;
+
+static const Bench benches[] =
+{
+  { "object-new", bench_object_new },
+  { "object-ref", bench_object_ref },
+  { "buffer-new", bench_buffer_new },
+  { "mini-object-ref", bench_mini_object_ref },
+};
+
+typedef struct
+{
+  const Bench *bench;
+  guint iterations;
+  GMutex mutex;
+  GCond cond;
+  gboolean started;
+} BenchRun;
+
+static gpointer
+bench_thread (gpointer data)
+{
+  BenchRun *run = data;
+
+  /* Wait for all threads to be created, so that they run concurrently. */
+  g_mutex_lock (&run->mutex);
+  while (!run->started)
+    g_cond_wait (&run->cond, &run->mutex);
+  g_mutex_unlock (&run->mutex);
+
+  run->bench->func (run->iterations);
+
+  return NULL;
+}
+
+static void
+run_bench (const Bench *bench,
+    guint n_threads,
+    guint iterations,
+    const gchar *label)
+{
+  BenchRun run;
+  GThread **threads;
+  gint64 start, elapsed;
+  guint i;
+
+  run.bench = bench;
+  run.iterations = iterations;
+  run.started = FALSE;
+  g_mutex_init (&run.mutex);
+  g_cond_init (&run.cond);
+
+  /* Warm up: register types, fill caches and allocator pools. */
+  bench->func (MIN (iterations, 1000));
+
+  threads = g_new (GThread *, n_threads);
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("bench", bench_thread, &run);
+
+  g_mutex_lock (&run.mutex);
+  run.started = TRUE;
+  start = g_get_monotonic_time ();
+  g_cond_broadcast (&run.cond);
+  g_mutex_unlock (&run.mutex);
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (threads[i]);
+
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+  g_free (threads);
+
+  g_print ("%s%sbench=%s threads=%u iterations=%u ns_per_op=%.1f "
+      "ops_per_s=%.0f\n", label != NULL ? label : "",
+      label != NULL ? " " : "", bench->name, n_threads, iterations,
+      elapsed * 1000.0 / iterations,
+      (gdouble) iterations * n_threads * G_USEC_PER_SEC / elapsed);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gint n_threads = 1;
+  gint iterations = 1000000;
+  gchar *bench_name = NULL;
+  gchar *label = NULL;
+  const GOptionEntry entries[] =
+  {
+    { "threads", 't', 0, G_OPTION_ARG_INT, &n_threads,
+      "Number of threads running each benchmark (default: 1)", "N" },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+      "Iterations per thread (default: 1000000)", "N" },
+    { "bench", 'b', 0, G_OPTION_ARG_STRING, &bench_name,
+      "Only run this benchmark", "NAME" },
+    { "label", 'l', 0, G_OPTION_ARG_STRING, &label,
+      "key=value pairs to prefix every result line with", "LABEL" },
+    { NULL, }
+  };
+  guint i;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  gst_init (&argc, &argv);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  n_threads = MAX (n_threads, 1);
+  iterations = MAX (iterations, 1);
+
+  for (i = 0; i < G_N_ELEMENTS (benches); i++)
+    {
+      if (bench_name != NULL && g_strcmp0 (bench_name, benches[i].name) != 0)
+        continue;
+
+      run_bench (&benches[i], n_threads, iterations, label);
+    }
+
+  return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * gobject-list-pipeline-bench: GStreamer pipeline throughput and latency
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Runs @n_pipelines copies of
+ *
+ *   fakesrc num-buffers=N ! queue ! identity ! fakesink
+ *
+ * in parallel and prints their total throughput and the latency of each
+ * buffer from the fakesrc handoff to the fakesink handoff, as one line of
+ * key=value pairs like gobject-list-bench:
+ *
+ *   bench=pipeline pipelines=4 buffers=100000 buffers_per_s=… latency_mean_us=…
+ *
+ * Buffers go through each pipeline in order, so the i-th buffer out of
+ * fakesink is the i-th buffer out of fakesrc. Buffers created while
+ * prerolling, before the measurement starts, are left out of both. */
+
+#include <glib-object.h>
+#include <gst/gst.h>
+
+#include <stdlib.h>
+
+typedef struct
+{
+  GstElement *pipeline;
+  gint64 *src_times;  /* owned; monotonic time of each buffer’s creation */
+  gint64 *sink_times;  /* owned; monotonic time of each buffer’s arrival */
+  guint n_src;
+  guint n_sink;
+  guint n_buffers;
+  /* Whether the measurement started, and buffers created before it */
+  gint measuring;
+  gint n_preroll;
+  guint n_sink_preroll;  /* preroll buffers seen by fakesink so far */
+} PipelineRun;
+
+static void
+src_handoff_cb (G_GNUC_UNUSED GstElement *src,
+    G_GNUC_UNUSED GstBuffer *buffer,
+    G_GNUC_UNUSED GstPad *pad,
+    gpointer user_data)
+{
+  PipelineRun *run = user_data;
+
+  if (!g_atomic_int_get (&run->measuring))
+    g_atomic_int_inc (&run->n_preroll);
+  else if (run->n_src < run->n_buffers)
+    run->src_times[run->n_src++] = g_get_monotonic_time ();
+}
+
+static void
+sink_handoff_cb (G_GNUC_UNUSED GstElement *sink,
+    G_GNUC_UNUSED GstBuffer *buffer,
+    G_GNUC_UNUSED GstPad *pad,
+    gpointer user_data)
+{
+  PipelineRun *run = user_data;
+
+  /* Only rendered once PLAYING, so the preroll count is final by now */
+  if (run->n_sink_preroll < (guint) g_atomic_int_get (&run->n_preroll))
+    run->n_sink_preroll++;
+  else if (run->n_sink < run->n_buffers)
+    run->sink_times[run->n_sink++] = g_get_monotonic_time ();
+}
+
+static gboolean
+pipeline_run_init (PipelineRun *run,
+    guint n_buffers)
+{
+  GError *error = NULL;
+  GstElement *src, *sink;
+  gchar *description;
+
+  description = g_strdup_printf ("fakesrc name=src num-buffers=%u "
+      "sizetype=fixed sizemax=4096 signal-handoffs=true ! queue ! identity ! "
+      "fakesink name=sink sync=false signal-handoffs=true", n_buffers);
+  run->pipeline = gst_parse_launch (description, &error);
+  g_free (description);
+
+  if (run->pipeline == NULL)
+    {
+      g_printerr ("Failed to create pipeline: %s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  run->n_buffers = n_buffers;
+  run->n_src = run->n_sink = 0;
+  run->measuring = FALSE;
+  run->n_preroll = 0;
+  run->n_sink_preroll = 0;
+  run->src_times = g_new0 (gint64, n_buffers);
+  run->sink_times = g_new0 (gint64, n_buffers);
+
+  src = gst_bin_get_by_name (GST_BIN (run->pipeline), "src");
+  sink = gst_bin_get_by_name (GST_BIN (run->pipeline), "sink");
+  g_signal_connect (src, "handoff", G_CALLBACK (src_handoff_cb), run);
+  g_signal_connect (sink, "handoff", G_CALLBACK (sink_handoff_cb), run);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+
+  return TRUE;
+}
+
+static gboolean
+pipeline_run_wait (PipelineRun *run)
+{
+  GstBus *bus = gst_element_get_bus (run->pipeline);
+  GstMessage *message;
+  gboolean ret;
+
+  message = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  ret = (GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS);
+
+  gst_message_unref (message);
+  gst_object_unref (bus);
+
+  return ret;
+}
+
+static void
+pipeline_run_clear (PipelineRun *run)
+{
+  gst_element_set_state (run->pipeline, GST_STATE_NULL);
+  gst_object_unref (run->pipeline);
+  g_free (run->src_times);
+  g_free (run->sink_times);
+}
+
+static gint
+compare_latencies (gconstpointer a,
+    gconstpointer b)
+{
+  gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gint n_pipelines = 1;
+  gint n_buffers = 100000;
+  gchar *label = NULL;
+  const GOptionEntry entries[] =
+  {
+    { "pipelines", 'p', 0, G_OPTION_ARG_INT, &n_pipelines,
+      "Number of pipelines running in parallel (default: 1)", "M" },
+    { "buffers", 'n', 0, G_OPTION_ARG_INT, &n_buffers,
+      "Buffers pushed through each pipeline (default: 100000)", "N" },
+    { "label", 'l', 0, G_OPTION_ARG_STRING, &label,
+      "key=value pairs to prefix the result line with", "LABEL" },
+    { NULL, }
+  };
+  PipelineRun *runs;
+  GArray *latencies;
+  gint64 start, elapsed, total_latency = 0;
+  guint64 n_total = 0;
+  gboolean ok = TRUE;
+  gint i;
+  guint j;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  gst_init (&argc, &argv);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  n_pipelines = MAX (n_pipelines, 1);
+  n_buffers = MAX (n_buffers, 1);
+
+  runs = g_new0 (PipelineRun, n_pipelines);
+  for (i = 0; i < n_pipelines; i++)
+    {
+      if (!pipeline_run_init (&runs[i], n_buffers))
+        return 1;
+      gst_element_set_state (runs[i].pipeline, GST_STATE_PAUSED);
+    }
+
+  /* Wait for all pipelines to preroll, so that element setup is not part of
+   * the measurement. */
+  for (i = 0; i < n_pipelines; i++)
+    gst_element_get_state (runs[i].pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_pipelines; i++)
+    g_atomic_int_set (&runs[i].measuring, TRUE);
+  for (i = 0; i < n_pipelines; i++)
+    gst_element_set_state (runs[i].pipeline, GST_STATE_PLAYING);
+  for (i = 0; i < n_pipelines; i++)
+    ok &= pipeline_run_wait (&runs[i]);
+
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  if (!ok)
+    {
+      g_printerr ("A pipeline failed\n");
+      return 1;
+    }
+
+  latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  for (i = 0; i < n_pipelines; i++)
+    {
+      for (j = 0; j < MIN (runs[i].n_src, runs[i].n_sink); j++)
+        {
+          gint64 latency = runs[i].sink_times[j] - runs[i].src_times[j];
+
+          g_array_append_val (latencies, latency);
+          total_latency += latency;
+        }
+
+      n_total += runs[i].n_sink;
+      pipeline_run_clear (&runs[i]);
+    }
+
+  g_array_sort (latencies, compare_latencies);
+
+  g_print ("%s%sbench=pipeline pipelines=%d buffers=%d buffers_per_s=%.0f "
+      "latency_mean_us=%.1f latency_p50_us=%" G_GINT64_FORMAT
+      " latency_p99_us=%" G_GINT64_FORMAT "\n",
+      label != NULL ? label : "", label != NULL ? " " : "",
+      n_pipelines, n_buffers, (gdouble) n_total * G_USEC_PER_SEC / elapsed,
+      latencies->len > 0 ? (gdouble) total_latency / latencies->len : 0.0,
+      latencies->len > 0 ?
+          g_array_index (latencies, gint64, latencies->len / 2) : 0,
+      latencies->len > 0 ?
+          g_array_index (latencies, gint64, latencies->len * 99 / 100) : 0);
+
+  g_array_free (latencies, TRUE);
+  g_free (runs);
+
+  return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * gobject-list-stress: check the registry under concurrent use
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Hammers creation, ref, unref and finalization of GObjects and GstBuffers
+ * from many threads at once, including unrefs from a different thread than
+ * the one which created the object, then checks that what gobject-list
+ * tracked matches what actually happened.
+ *
+ * Must be run with LD_PRELOAD=libgobject-list.so. The registry is read back
+ * through the shared memory segment of this very process, which is enabled
+ * before GStreamer is initialised. Exits with 0 if the per-type counters and
+ * the live object table match the ground truth, 1 if they do not, and 77 if
+ * gobject-list is not loaded.
+ *
+ * Objects which are handed to other threads while they are still being
+ * constructed are a known blind spot of gobject-list (see the FIXME in its
+ * g_object_new()), so this does not do that. */
+
+#include <glib-object.h>
+#include <gst/gst.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gobject-list-shm.h"
+
+typedef struct
+{
+  GObject parent;
+} StressObject;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} StressObjectClass;
+
+GType stress_object_get_type (void);
+
+G_DEFINE_TYPE (StressObject, stress_object, G_TYPE_OBJECT)
+
+static void
+stress_object_class_init (G_GNUC_UNUSED StressObjectClass *klass)
+{
+}
+
+static void
+stress_object_init (G_GNUC_UNUSED StressObject *self)
+{
+}
+
+typedef struct
+{
+  guint index;
+  GAsyncQueue *unref_queue;  /* owned; objects to unref from this thread */
+  GPtrArray *objects;  /* owned; objects owned by this thread */
+  GThread *thread;
+} Worker;
+
+static Worker *workers = NULL;
+static guint n_workers = 0;
+static guint iterations = 100000;
+static guint n_kept = 16;  /* objects of each kind kept alive per worker */
+
+/* Ground truth */
+static volatile gint n_objects_created = 0;
+static volatile gint n_buffers_created = 0;
+
+/* Barrier between producing objects and draining the unref queues */
+static GMutex barrier_mutex;
+static GCond barrier_cond;
+static guint n_producing = 0;
+
+static gboolean
+is_buffer (gpointer obj)
+{
+  /* GstMiniObject starts with its GType, GObject with its class pointer. */
+  return GST_IS_BUFFER (obj);
+}
+
+static void
+unref_any (gpointer obj)
+{
+  if (is_buffer (obj))
+    gst_mini_object_unref (GST_MINI_OBJECT_CAST (obj));
+  else
+    g_object_unref (obj);
+}
+
+static gpointer
+ref_any (gpointer obj)
+{
+  if (is_buffer (obj))
+    return gst_mini_object_ref (GST_MINI_OBJECT_CAST (obj));
+  else
+    return g_object_ref (obj);
+}
+
+static void
+drain_unref_queue (Worker *worker)
+{
+  gpointer obj;
+
+  while ((obj = g_async_queue_try_pop (worker->unref_queue)) != NULL)
+    unref_any (obj);
+}
+
+static gpointer
+worker_thread (gpointer data)
+{
+  Worker *worker = data;
+  GRand *rand = g_rand_new_with_seed (worker->index);
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      GPtrArray *objects = worker->objects;
+      gpointer obj;
+      guint n;
+
+      switch (g_rand_int_range (rand, 0, 7))
+        {
+        case 0:
+          g_ptr_array_add (objects, g_object_new (stress_object_get_type (),
+              NULL));
+          g_atomic_int_inc (&n_objects_created);
+          break;
+        case 1:
+          if (g_rand_int (rand) % 2)
+            g_ptr_array_add (objects, gst_buffer_new ());
+          else
+            g_ptr_array_add (objects, gst_buffer_new_allocate (NULL, 64,
+                NULL));
+          g_atomic_int_inc (&n_buffers_created);
+          break;
+        case 2:
+          /* Ref and unref, possibly from another thread. */
+          if (objects->len == 0)
+            break;
+          obj = ref_any (g_ptr_array_index (objects,
+              g_rand_int_range (rand, 0, objects->len)));
+          n = g_rand_int_range (rand, 0, n_workers);
+          g_async_queue_push (workers[n].unref_queue, obj);
+          break;
+        case 3:
+          /* Hand over the last reference to another thread. */
+          if (objects->len == 0)
+            break;
+          obj = g_ptr_array_remove_index_fast (objects,
+              g_rand_int_range (rand, 0, objects->len));
+          n = g_rand_int_range (rand, 0, n_workers);
+          g_async_queue_push (workers[n].unref_queue, obj);
+          break;
+        case 4:
+        case 5:
+          if (objects->len == 0)
+            break;
+          unref_any (g_ptr_array_remove_index_fast (objects,
+              g_rand_int_range (rand, 0, objects->len)));
+          break;
+        case 6:
+          drain_unref_queue (worker);
+          break;
+        }
+    }
+
+  g_mutex_lock (&barrier_mutex);
+  if (--n_producing == 0)
+    g_cond_broadcast (&barrier_cond);
+  while (n_producing > 0)
+    g_cond_wait (&barrier_cond, &barrier_mutex);
+  g_mutex_unlock (&barrier_mutex);
+
+  /* Nobody pushes to the queues any more. */
+  drain_unref_queue (worker);
+
+  g_rand_free (rand);
+
+  return NULL;
+}
+
+/* Keep @n_kept objects and buffers per worker, creating more if needed, and
+ * unref all the others. */
+static void
+settle_worker (Worker *worker,
+    GHashTable *kept)
+{
+  guint n_objects = 0, n_buffers = 0;
+  guint i;
+
+  for (i = 0; i < worker->objects->len; i++)
+    {
+      gpointer obj = g_ptr_array_index (worker->objects, i);
+      guint *n = is_buffer (obj) ? &n_buffers : &n_objects;
+
+      if (*n < n_kept)
+        {
+          (*n)++;
+          g_hash_table_add (kept, obj);
+        }
+      else
+        {
+          unref_any (obj);
+        }
+    }
+
+  for (; n_objects < n_kept; n_objects++)
+    {
+      g_hash_table_add (kept, g_object_new (stress_object_get_type (), NULL));
+      g_atomic_int_inc (&n_objects_created);
+    }
+
+  for (; n_buffers < n_kept; n_buffers++)
+    {
+      g_hash_table_add (kept, gst_buffer_new ());
+      g_atomic_int_inc (&n_buffers_created);
+    }
+
+  g_ptr_array_set_size (worker->objects, 0);
+}
+
+static GObjectListShmHeader *
+map_own_segment (void)
+{
+  GObjectListShmHeader *header;
+  gchar *name;
+  struct stat st;
+  gpointer mem;
+  gint fd;
+
+  name = g_strdup_printf (GOBJECT_LIST_SHM_NAME_FORMAT, getpid ());
+  fd = shm_open (name, O_RDONLY, 0);
+  g_free (name);
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat (fd, &st) < 0 ||
+      (mem = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+          MAP_FAILED)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  close (fd);
+  header = mem;
+
+  if (header->magic != GOBJECT_LIST_SHM_MAGIC ||
+      header->version != GOBJECT_LIST_SHM_VERSION)
+    return NULL;
+
+  return header;
+}
+
+static gboolean
+check_type (const GObjectListShmHeader *header,
+    const gchar *type_name,
+    guint64 expected_created,
+    GHashTable *kept,
+    gboolean is_buffer_type)
+{
+  const GObjectListShmType *types = gobject_list_shm_get_types (header);
+  const GObjectListShmObject *objects = gobject_list_shm_get_objects (header);
+  guint64 expected_live = 0, n_listed = 0, n_missing = 0;
+  GHashTableIter iter;
+  GHashTable *listed;
+  gpointer obj;
+  gboolean ok = TRUE;
+  gint index = -1;
+  guint i;
+
+  for (i = 0; i < header->n_types; i++)
+    {
+      if (strcmp (types[i].name, type_name) == 0)
+        index = i;
+    }
+
+  if (index < 0)
+    {
+      g_print ("FAIL %s: type not tracked\n", type_name);
+      return FALSE;
+    }
+
+  g_hash_table_iter_init (&iter, kept);
+  while (g_hash_table_iter_next (&iter, &obj, NULL))
+    {
+      if (is_buffer (obj) == is_buffer_type)
+        expected_live++;
+    }
+
+  if (types[index].live != expected_live ||
+      types[index].created != expected_created ||
+      types[index].finalized != expected_created - expected_live)
+    {
+      g_print ("FAIL %s: live %" G_GUINT64_FORMAT ", created %"
+          G_GUINT64_FORMAT ", finalized %" G_GUINT64_FORMAT
+          "; expected %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT ", %"
+          G_GUINT64_FORMAT "\n", type_name, types[index].live,
+          types[index].created, types[index].finalized, expected_live,
+          expected_created, expected_created - expected_live);
+      ok = FALSE;
+    }
+
+  if (header->overflow_objects > 0)
+    {
+      g_print ("SKIP %s: live object table overflowed\n", type_name);
+      return ok;
+    }
+
+  /* The live object table must list exactly the kept objects. */
+  listed = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < header->n_object_slots; i++)
+    {
+      if (objects[i].address == 0 || objects[i].type_index != (guint) index)
+        continue;
+
+      n_listed++;
+      g_hash_table_add (listed, GSIZE_TO_POINTER (objects[i].address));
+    }
+
+  g_hash_table_iter_init (&iter, kept);
+  while (g_hash_table_iter_next (&iter, &obj, NULL))
+    {
+      if (is_buffer (obj) == is_buffer_type &&
+          !g_hash_table_contains (listed, obj))
+        n_missing++;
+    }
+
+  if (n_listed != expected_live || n_missing > 0)
+    {
+      g_print ("FAIL %s: %" G_GUINT64_FORMAT " objects listed, %"
+          G_GUINT64_FORMAT " expected, %" G_GUINT64_FORMAT " missing\n",
+          type_name, n_listed, expected_live, n_missing);
+      ok = FALSE;
+    }
+
+  g_hash_table_unref (listed);
+
+  if (ok)
+    g_print ("PASS %s: %" G_GUINT64_FORMAT " created, %" G_GUINT64_FORMAT
+        " live\n", type_name, expected_created, expected_live);
+
+  return ok;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gint threads_arg = 0, iterations_arg = 100000, kept_arg = 16;
+  const GOptionEntry entries[] =
+  {
+    { "threads", 't', 0, G_OPTION_ARG_INT, &threads_arg,
+      "Number of threads (default: twice the number of CPUs)", "N" },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations_arg,
+      "Operations per thread (default: 100000)", "N" },
+    { "keep", 'k', 0, G_OPTION_ARG_INT, &kept_arg,
+      "Objects of each kind left alive per thread (default: 16)", "N" },
+    { NULL, }
+  };
+  GObjectListShmHeader *header;
+  GHashTable *kept;
+  gchar **names;
+  gboolean ok;
+  guint i;
+
+  /* gobject-list reads its settings when it sees its first object, which
+   * happens in gst_init() at the latest. Any other setting from the
+   * environment would change what is tracked. */
+  names = g_listenv ();
+  for (i = 0; names[i] != NULL; i++)
+    {
+      if (g_str_has_prefix (names[i], "GOBJECT_LIST_"))
+        g_unsetenv (names[i]);
+    }
+  g_strfreev (names);
+
+  g_setenv ("GOBJECT_LIST_SHM", "1", TRUE);
+  g_setenv ("GOBJECT_LIST_SHM_OBJECTS", "1048576", TRUE);
+  g_setenv ("GOBJECT_LIST_DISPLAY", "none", TRUE);
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  gst_init (&argc, &argv);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  header = map_own_segment ();
+  if (header == NULL)
+    {
+      g_print ("SKIP: not running with LD_PRELOAD=libgobject-list.so\n");
+      return 77;
+    }
+
+  n_workers = (threads_arg > 0) ?
+      (guint) threads_arg : 2 * g_get_num_processors ();
+  iterations = MAX (iterations_arg, 1);
+  n_kept = MAX (kept_arg, 0);
+  n_producing = n_workers;
+
+  workers = g_new0 (Worker, n_workers);
+  for (i = 0; i < n_workers; i++)
+    {
+      workers[i].index = i;
+      workers[i].unref_queue = g_async_queue_new ();
+      workers[i].objects = g_ptr_array_new ();
+    }
+
+  for (i = 0; i < n_workers; i++)
+    workers[i].thread = g_thread_new ("stress", worker_thread, &workers[i]);
+  for (i = 0; i < n_workers; i++)
+    g_thread_join (workers[i].thread);
+
+  kept = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < n_workers; i++)
+    settle_worker (&workers[i], kept);
+
+  ok = check_type (header, "StressObject", n_objects_created, kept, FALSE);
+  ok &= check_type (header, "GstBuffer", n_buffers_created, kept, TRUE);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Run the gobject-list microbenchmarks without the library, then with it
+# preloaded in each display mode and filter setting, for 1 up to $MAX_THREADS
+# threads, followed by the pipeline benchmark with 1 up to $MAX_THREADS
+# parallel pipelines. Only the result lines are printed, so the output can be
+# saved and compared between versions.
+#
+# Usage: bench/run-bench.sh [ITERATIONS [BUFFERS]]
+
+set -e
+
+top_dir=$(cd "$(dirname "$0")/.." && pwd)
+bench="$top_dir/bench/gobject-list-bench"
+pipeline_bench="$top_dir/bench/gobject-list-pipeline-bench"
+library="$top_dir/libgobject-list.so"
+iterations=${1:-200000}
+buffers=${2:-50000}
+max_threads=${MAX_THREADS:-$(nproc 2>/dev/null || echo 4)}
+
+threads=1
+thread_counts=""
+while [ "$threads" -le "$max_threads" ]; do
+	thread_counts="$thread_counts $threads"
+	threads=$((threads * 2))
+done
+
+run () {
+	label=$1
+	shift
+	for threads in $thread_counts; do
+		env "$@" "$bench" --threads "$threads" --iterations "$iterations" \
+			--label "$label" 2>/dev/null | grep "bench="
+	done
+}
+
+run_pipelines () {
+	label=$1
+	shift
+	for pipelines in $thread_counts; do
+		env "$@" "$pipeline_bench" --pipelines "$pipelines" \
+			--buffers "$buffers" --label "$label" 2>/dev/null | grep "bench="
+	done
+}
+
+run "preload=no display=- filter=-"
+
+# Backtraces are only printed along with other messages.
+for display in none create refs create,backtrace; do
+	run "preload=yes display=$display filter=-" \
+		LD_PRELOAD="$library" GOBJECT_LIST_DISPLAY="$display"
+done
+
+# A filter which matches the benchmark objects, and one which matches none of
+# them, so that the cost of the filtering itself shows up.
+for filter in BenchObject NoSuchType; do
+	run "preload=yes display=none filter=$filter" \
+		LD_PRELOAD="$library" GOBJECT_LIST_DISPLAY=none \
+		GOBJECT_LIST_FILTER="$filter"
+done
+
+run_pipelines "preload=no display=-"
+
+for display in none create refs create,backtrace; do
+	run_pipelines "preload=yes display=$display" \
+		LD_PRELOAD="$library" GOBJECT_LIST_DISPLAY="$display"
+done
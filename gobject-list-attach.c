@@ -0,0 +1,756 @@
+/*
+ * gobject-list-attach: load gobject-list into a running process
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* The process is stopped with ptrace(), and its main thread made to call
+ * dlopen() on libgobject-list.so and then gobject_list_attach(), as if it had
+ * called them itself; its registers are restored afterwards. To call a
+ * function, the arguments are put in registers and the return address is set
+ * to 0, so that the thread stops with SIGSEGV at address 0 once the function
+ * returns.
+ *
+ * dlopen() takes the malloc and dynamic loader locks, so the thread is first
+ * single-stepped out of the C library and the loader, where it may be holding
+ * them, unless it is blocked in a system call. Calls which do not return in
+ * time are abandoned: the thread is stopped again and its registers restored,
+ * rather than leaving the process stopped forever. */
+#define _GNU_SOURCE
+
+#include <glib.h>
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined (__x86_64__)
+#define REG_PC(regs) ((regs).rip)
+#define REG_SP(regs) ((regs).rsp)
+#define REG_RET(regs) ((regs).rax)
+#define RED_ZONE 128
+#elif defined (__aarch64__)
+#define REG_PC(regs) ((regs).pc)
+#define REG_SP(regs) ((regs).sp)
+#define REG_RET(regs) ((regs).regs[0])
+#define RED_ZONE 0
+#endif
+
+/* Room below the stack pointer for the strings passed to the called
+ * functions */
+#define SCRATCH_SIZE 4096
+
+/* How long to step the thread out of the C library for, how long a single
+ * step may block in a system call, and how long a remote call may take */
+#define SAFE_POINT_TIMEOUT (5 * G_TIME_SPAN_SECOND)
+#define STEP_TIMEOUT (100 * G_TIME_SPAN_MILLISECOND)
+#define CALL_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+
+#ifdef REG_PC
+
+/* State of the stopped thread */
+typedef struct
+{
+  pid_t pid;
+  gint mem_fd;  /* /proc/PID/mem */
+  struct user_regs_struct saved;
+#ifdef __aarch64__
+  gint saved_syscall;
+#endif
+  guint64 scratch;  /* address of the scratch area on the stack */
+  guint64 scratch_used;
+  gint pending_signal;  /* received while stepping, delivered on detach */
+} Target;
+
+/* An address range of /proc/PID/maps */
+typedef struct
+{
+  guint64 start;
+  guint64 end;
+} MapRange;
+
+static gboolean detach = FALSE;
+static gchar *library = NULL;
+
+static const GOptionEntry entries[] =
+{
+  { "detach", 'd', 0, G_OPTION_ARG_NONE, &detach,
+    "Stop tracking and restore the hooked functions", NULL },
+  { "library", 'l', 0, G_OPTION_ARG_FILENAME, &library,
+    "Path of libgobject-list.so (default: next to this program)", "PATH" },
+  { NULL, }
+};
+
+static gboolean
+get_regs (pid_t pid,
+    struct user_regs_struct *regs)
+{
+  struct iovec iov = { regs, sizeof (*regs) };
+
+  return ptrace (PTRACE_GETREGSET, pid, NT_PRSTATUS, &iov) == 0;
+}
+
+static gboolean
+set_regs (pid_t pid,
+    const struct user_regs_struct *regs)
+{
+  struct iovec iov = { (gpointer) regs, sizeof (*regs) };
+
+  return ptrace (PTRACE_SETREGSET, pid, NT_PRSTATUS, &iov) == 0;
+}
+
+#ifdef __aarch64__
+/* The syscall the thread was stopped in, which the kernel restarts when the
+ * thread resumes unless it is set to -1. */
+static gboolean
+get_syscall (pid_t pid,
+    gint *syscall)
+{
+  struct iovec iov = { syscall, sizeof (*syscall) };
+
+  return ptrace (PTRACE_GETREGSET, pid, NT_ARM_SYSTEM_CALL, &iov) == 0;
+}
+
+static gboolean
+set_syscall (pid_t pid,
+    gint syscall)
+{
+  struct iovec iov = { &syscall, sizeof (syscall) };
+
+  return ptrace (PTRACE_SETREGSET, pid, NT_ARM_SYSTEM_CALL, &iov) == 0;
+}
+#endif
+
+/* Whether the thread of @target was stopped in a system call */
+static gboolean
+in_syscall (const Target *target)
+{
+#if defined (__x86_64__)
+  return (glong) target->saved.orig_rax >= 0;
+#else
+  return target->saved_syscall != -1;
+#endif
+}
+
+/* Wait for the thread of @target to change state until @deadline. Returns
+ * as waitpid() does, 0 meaning that it timed out. */
+static pid_t
+wait_target (Target *target,
+    gint64 deadline,
+    gint *status)
+{
+  pid_t ret;
+
+  while ((ret = waitpid (target->pid, status, __WALL | WNOHANG)) == 0 &&
+      g_get_monotonic_time () < deadline)
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+
+  if (ret < 0)
+    g_printerr ("Failed to wait for %d: %s\n", target->pid,
+        g_strerror (errno));
+
+  return ret;
+}
+
+/* Stop the thread of @target, which is running, and wait until it is. Traps
+ * and faults caused by the tool itself are not delivered. */
+static gboolean
+stop_target (Target *target)
+{
+  if (syscall (SYS_tgkill, target->pid, target->pid, SIGSTOP) < 0)
+    return FALSE;
+
+  while (TRUE)
+    {
+      gint status, sig;
+
+      if (waitpid (target->pid, &status, __WALL) < 0 ||
+          WIFEXITED (status) || WIFSIGNALED (status))
+        return FALSE;
+
+      if (!WIFSTOPPED (status))
+        continue;
+
+      sig = WSTOPSIG (status);
+      if (sig == SIGSTOP)
+        return TRUE;
+
+      ptrace (PTRACE_CONT, target->pid, NULL,
+          GINT_TO_POINTER (sig == SIGTRAP || sig == SIGSEGV ? 0 : sig));
+    }
+}
+
+/* Read the registers of the stopped thread of @target into @target->saved */
+static gboolean
+save_regs (Target *target)
+{
+  gboolean ok = get_regs (target->pid, &target->saved);
+
+#ifdef __aarch64__
+  ok = ok && get_syscall (target->pid, &target->saved_syscall);
+#endif
+
+  return ok;
+}
+
+/* Mappings of the C library and of the dynamic loader in @pid */
+static GArray *
+libc_ranges (pid_t pid)
+{
+  GArray *ranges = g_array_new (FALSE, FALSE, sizeof (MapRange));
+  gchar *maps, *contents, **lines;
+  guint i;
+
+  maps = g_strdup_printf ("/proc/%d/maps", pid);
+  if (!g_file_get_contents (maps, &contents, NULL, NULL))
+    {
+      g_free (maps);
+      return ranges;
+    }
+
+  g_free (maps);
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      MapRange range;
+      const gchar *name;
+      gint pos = 0;
+
+      if (sscanf (lines[i], "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER
+              "x %*s %*s %*s %*s %n", &range.start, &range.end, &pos) < 2 ||
+          pos == 0 || lines[i][pos] != '/')
+        continue;
+
+      name = strrchr (lines[i] + pos, '/') + 1;
+      if (g_str_has_prefix (name, "libc.so") ||
+          g_str_has_prefix (name, "libc-") ||
+          g_str_has_prefix (name, "libpthread") ||
+          g_str_has_prefix (name, "ld-"))
+        g_array_append_val (ranges, range);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return ranges;
+}
+
+static gboolean
+in_ranges (GArray *ranges,
+    guint64 address)
+{
+  guint i;
+
+  for (i = 0; i < ranges->len; i++)
+    {
+      const MapRange *range = &g_array_index (ranges, MapRange, i);
+
+      if (address >= range->start && address < range->end)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Single-step the stopped thread of @target out of the C library and the
+ * dynamic loader, where it may be holding the locks dlopen() takes. A thread
+ * blocked in a system call is left there: the locks are not held across the
+ * blocking ones. @target->saved is updated as the thread moves. */
+static gboolean
+reach_safe_point (Target *target)
+{
+  GArray *ranges = libc_ranges (target->pid);
+  gint64 deadline = g_get_monotonic_time () + SAFE_POINT_TIMEOUT;
+  gboolean ok = TRUE;
+
+  while (ok && !in_syscall (target) &&
+      in_ranges (ranges, REG_PC (target->saved)))
+    {
+      gint status = 0;
+      pid_t ret;
+
+      if (g_get_monotonic_time () >= deadline)
+        {
+          g_printerr ("Process %d did not leave the C library in time\n",
+              target->pid);
+          ok = FALSE;
+          break;
+        }
+
+      if (ptrace (PTRACE_SINGLESTEP, target->pid, NULL,
+              GINT_TO_POINTER (target->pending_signal)) < 0)
+        {
+          g_printerr ("Failed to step %d: %s\n", target->pid,
+              g_strerror (errno));
+          ok = FALSE;
+          break;
+        }
+
+      target->pending_signal = 0;
+      ret = wait_target (target, g_get_monotonic_time () + STEP_TIMEOUT,
+          &status);
+
+      if (ret == 0)
+        {
+          /* Blocked in a system call, which is where it is stopped */
+          ok = stop_target (target);
+        }
+      else if (ret < 0 || WIFEXITED (status) || WIFSIGNALED (status))
+        {
+          ok = FALSE;
+        }
+      else if (WIFSTOPPED (status) && WSTOPSIG (status) != SIGTRAP &&
+          WSTOPSIG (status) != SIGSTOP)
+        {
+          target->pending_signal = WSTOPSIG (status);
+        }
+
+      ok = ok && save_regs (target);
+    }
+
+  g_array_unref (ranges);
+
+  return ok;
+}
+
+/* Copy @data to the scratch area of @target and return its address there */
+static guint64
+push_data (Target *target,
+    gconstpointer data,
+    gsize len)
+{
+  guint64 address = target->scratch + target->scratch_used;
+
+  if (target->scratch_used + len > SCRATCH_SIZE ||
+      pwrite (target->mem_fd, data, len, address) != (gssize) len)
+    return 0;
+
+  target->scratch_used += len;
+
+  return address;
+}
+
+static gchar *
+read_string (Target *target,
+    guint64 address)
+{
+  gchar buf[512];
+  gssize len;
+
+  len = pread (target->mem_fd, buf, sizeof (buf) - 1, address);
+  if (len < 0)
+    return g_strdup ("(unreadable)");
+
+  buf[len] = '\0';
+
+  return g_strdup (buf);
+}
+
+/* Make the stopped thread call @func (@arg0, @arg1) and wait for it to
+ * return, for CALL_TIMEOUT at most. Other signals received in the meantime
+ * are delivered. */
+static gboolean
+remote_call (Target *target,
+    guint64 func,
+    guint64 arg0,
+    guint64 arg1,
+    guint64 *ret)
+{
+  struct user_regs_struct regs = target->saved;
+  guint64 sp = target->scratch & ~(guint64) 15;
+  gint64 deadline = g_get_monotonic_time () + CALL_TIMEOUT;
+
+#if defined (__x86_64__)
+  guint64 return_address = 0;
+
+  /* As if pushed by a call instruction */
+  sp -= 8;
+  if (pwrite (target->mem_fd, &return_address, sizeof (return_address), sp) !=
+      sizeof (return_address))
+    {
+      g_printerr ("Failed to write to the stack of %d: %s\n", target->pid,
+          g_strerror (errno));
+      return FALSE;
+    }
+
+  regs.rdi = arg0;
+  regs.rsi = arg1;
+  regs.rax = 0;
+  regs.orig_rax = -1;  /* do not restart an interrupted syscall */
+#else
+  regs.regs[0] = arg0;
+  regs.regs[1] = arg1;
+  regs.regs[30] = 0;  /* link register */
+  set_syscall (target->pid, -1);
+#endif
+
+  REG_SP (regs) = sp;
+  REG_PC (regs) = func;
+
+  if (!set_regs (target->pid, &regs) ||
+      ptrace (PTRACE_CONT, target->pid, NULL, NULL) < 0)
+    {
+      g_printerr ("Failed to resume %d: %s\n", target->pid,
+          g_strerror (errno));
+      return FALSE;
+    }
+
+  while (TRUE)
+    {
+      gint status = 0, sig;
+      pid_t waited = wait_target (target, deadline, &status);
+
+      if (waited < 0)
+        return FALSE;
+
+      if (waited == 0)
+        {
+          g_printerr ("Process %d did not return from a call in time, and is "
+              "restored as it was; it may have been holding a lock the call "
+              "needed, and may not be able to load libraries anymore\n",
+              target->pid);
+          stop_target (target);
+          return FALSE;
+        }
+
+      if (WIFEXITED (status) || WIFSIGNALED (status))
+        {
+          g_printerr ("Process %d died\n", target->pid);
+          return FALSE;
+        }
+
+      if (!WIFSTOPPED (status))
+        continue;
+
+      sig = WSTOPSIG (status);
+
+      if (sig == SIGSEGV)
+        {
+          if (!get_regs (target->pid, &regs) || REG_PC (regs) != 0)
+            {
+              g_printerr ("Process %d crashed while loading gobject-list\n",
+                  target->pid);
+              return FALSE;
+            }
+
+          *ret = REG_RET (regs);
+          return TRUE;
+        }
+
+      ptrace (PTRACE_CONT, target->pid, NULL,
+          GINT_TO_POINTER (sig == SIGSTOP ? 0 : sig));
+    }
+}
+
+/* Path of the mapping containing @address in the maps file @maps, or NULL */
+static gchar *
+maps_find_path (const gchar *maps,
+    guint64 address)
+{
+  gchar *contents, **lines, *path = NULL;
+  guint i;
+
+  if (!g_file_get_contents (maps, &contents, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; path == NULL && lines[i] != NULL; i++)
+    {
+      guint64 start, end;
+      gint pos = 0;
+
+      if (sscanf (lines[i], "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER
+              "x %*s %*s %*s %*s %n", &start, &end, &pos) >= 2 &&
+          pos > 0 && address >= start && address < end)
+        path = g_strdup (lines[i] + pos);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return path;
+}
+
+/* Load address of the file @path in the maps file @maps, or 0 */
+static guint64
+maps_find_base (const gchar *maps,
+    const gchar *path)
+{
+  gchar *contents, **lines;
+  guint64 base = 0;
+  guint i;
+
+  if (!g_file_get_contents (maps, &contents, NULL, NULL))
+    return 0;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; base == 0 && lines[i] != NULL; i++)
+    {
+      guint64 start, offset;
+      gint pos = 0;
+
+      if (sscanf (lines[i], "%" G_GINT64_MODIFIER "x-%*x %*s %"
+              G_GINT64_MODIFIER "x %*s %*s %n", &start, &offset,
+              &pos) >= 2 &&
+          pos > 0 && offset == 0 && strcmp (lines[i] + pos, path) == 0)
+        base = start;
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return base;
+}
+
+/* Address of the function @local of this process in @pid, which must have
+ * loaded the same library */
+static guint64
+remote_symbol (pid_t pid,
+    gpointer local,
+    const gchar *name)
+{
+  gchar *path, *maps;
+  guint64 local_base, remote_base;
+
+  path = maps_find_path ("/proc/self/maps", (guintptr) local);
+  if (path == NULL)
+    {
+      g_printerr ("Failed to find %s\n", name);
+      return 0;
+    }
+
+  local_base = maps_find_base ("/proc/self/maps", path);
+  maps = g_strdup_printf ("/proc/%d/maps", pid);
+  remote_base = maps_find_base (maps, path);
+  g_free (maps);
+
+  if (remote_base == 0)
+    {
+      g_printerr ("Process %d has not loaded %s, needed for %s\n", pid, path,
+          name);
+      g_free (path);
+      return 0;
+    }
+
+  g_free (path);
+
+  return (guintptr) local - local_base + remote_base;
+}
+
+static gboolean
+run (Target *target)
+{
+  guint64 remote_dlopen, remote_dlsym, remote_dlerror;
+  guint64 path, func_name, handle, func, ret;
+  const gchar *name = detach ? "gobject_list_detach" : "gobject_list_attach";
+
+  /* Through RTLD_NEXT to get the definitions, rather than PLT entries of
+   * this program */
+  remote_dlopen = remote_symbol (target->pid, dlsym (RTLD_NEXT, "dlopen"),
+      "dlopen");
+  remote_dlsym = remote_symbol (target->pid, dlsym (RTLD_NEXT, "dlsym"),
+      "dlsym");
+  remote_dlerror = remote_symbol (target->pid, dlsym (RTLD_NEXT, "dlerror"),
+      "dlerror");
+  if (remote_dlopen == 0 || remote_dlsym == 0 || remote_dlerror == 0)
+    return FALSE;
+
+  path = push_data (target, library, strlen (library) + 1);
+  func_name = push_data (target, name, strlen (name) + 1);
+  if (path == 0 || func_name == 0)
+    {
+      g_printerr ("Failed to write to the stack of %d: %s\n", target->pid,
+          g_strerror (errno));
+      return FALSE;
+    }
+
+  /* Not RTLD_GLOBAL, so that libraries opened later still bind to GLib */
+  if (!remote_call (target, remote_dlopen, path,
+          detach ? RTLD_NOW | RTLD_NOLOAD : RTLD_NOW, &handle))
+    return FALSE;
+
+  if (handle == 0)
+    {
+      gchar *message;
+
+      if (detach)
+        {
+          g_printerr ("gobject-list is not loaded in %d\n", target->pid);
+          return FALSE;
+        }
+
+      if (!remote_call (target, remote_dlerror, 0, 0, &ret))
+        return FALSE;
+
+      message = ret != 0 ? read_string (target, ret) : g_strdup ("unknown");
+      g_printerr ("Failed to load %s in %d: %s\n", library, target->pid,
+          message);
+      g_free (message);
+
+      return FALSE;
+    }
+
+  if (!remote_call (target, remote_dlsym, handle, func_name, &func))
+    return FALSE;
+
+  if (func == 0)
+    {
+      g_printerr ("%s does not export %s\n", library, name);
+      return FALSE;
+    }
+
+  return remote_call (target, func, 0, 0, &ret);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  Target target = { 0, };
+  gchar *mem;
+  gint status;
+  gboolean ok;
+
+  context = g_option_context_new ("PID");
+  g_option_context_set_summary (context,
+      "Load libgobject-list.so into a running process and start tracking\n"
+      "the objects it creates from now on, or stop tracking with --detach.\n"
+      "gobject-list settings are taken from the environment of the process.");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: %s [OPTION…] PID\n", argv[0]);
+      return 1;
+    }
+
+  if (library == NULL)
+    {
+      gchar *exe = g_file_read_link ("/proc/self/exe", NULL);
+      gchar *dir = g_path_get_dirname (exe);
+
+      library = g_build_filename (dir, "libgobject-list.so", NULL);
+      g_free (dir);
+      g_free (exe);
+    }
+
+  /* The path is resolved by the process, which has a different working
+   * directory */
+  if (!g_path_is_absolute (library))
+    {
+      gchar *cwd = g_get_current_dir ();
+      gchar *absolute = g_build_filename (cwd, library, NULL);
+
+      g_free (library);
+      library = absolute;
+      g_free (cwd);
+    }
+
+  target.pid = atoi (argv[1]);
+
+  if (ptrace (PTRACE_ATTACH, target.pid, NULL, NULL) < 0)
+    {
+      g_printerr ("Failed to attach to %d: %s\n"
+          "Check /proc/sys/kernel/yama/ptrace_scope, or run as root.\n",
+          target.pid, g_strerror (errno));
+      return 1;
+    }
+
+  do
+    {
+      if (waitpid (target.pid, &status, __WALL) < 0)
+        {
+          g_printerr ("Failed to wait for %d: %s\n", target.pid,
+              g_strerror (errno));
+          return 1;
+        }
+    }
+  while (!WIFSTOPPED (status));
+
+  mem = g_strdup_printf ("/proc/%d/mem", target.pid);
+  target.mem_fd = open (mem, O_RDWR);
+  g_free (mem);
+
+  ok = target.mem_fd >= 0 && save_regs (&target);
+
+  if (ok)
+    ok = reach_safe_point (&target);
+  else
+    g_printerr ("Failed to access %d: %s\n", target.pid,
+        g_strerror (errno));
+
+  if (ok)
+    {
+      target.scratch = REG_SP (target.saved) - RED_ZONE - SCRATCH_SIZE;
+      ok = run (&target);
+
+      set_regs (target.pid, &target.saved);
+#ifdef __aarch64__
+      set_syscall (target.pid, target.saved_syscall);
+#endif
+    }
+
+  if (target.mem_fd >= 0)
+    close (target.mem_fd);
+
+  ptrace (PTRACE_DETACH, target.pid, NULL,
+      GINT_TO_POINTER (target.pending_signal));
+
+  if (ok)
+    g_print ("%s %d\n", detach ? "Detached from" : "Attached to", target.pid);
+
+  return ok ? 0 : 1;
+}
+
+#else /* !REG_PC */
+
+int
+main (G_GNUC_UNUSED int argc,
+    G_GNUC_UNUSED char **argv)
+{
+  g_printerr ("gobject-list-attach only supports x86-64 and aarch64\n");
+
+  return 1;
+}
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * gobject-list: a LD_PRELOAD library for tracking the lifetime of GObjects
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#define _GNU_SOURCE
+
+#include "gobject-list-got.h"
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <link.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Relocation types which fill in the GOT entry of a function: the PLT slot of
+ * a called function, and the address of a function taken as a pointer. */
+#if defined (__x86_64__)
+#define GOT_R_JUMP_SLOT R_X86_64_JUMP_SLOT
+#define GOT_R_GLOB_DAT R_X86_64_GLOB_DAT
+#elif defined (__aarch64__)
+#define GOT_R_JUMP_SLOT R_AARCH64_JUMP_SLOT
+#define GOT_R_GLOB_DAT R_AARCH64_GLOB_DAT
+#elif defined (__i386__)
+#define GOT_R_JUMP_SLOT R_386_JMP_SLOT
+#define GOT_R_GLOB_DAT R_386_GLOB_DAT
+#elif defined (__arm__)
+#define GOT_R_JUMP_SLOT R_ARM_JUMP_SLOT
+#define GOT_R_GLOB_DAT R_ARM_GLOB_DAT
+#endif
+
+#ifdef GOT_R_JUMP_SLOT
+
+#if __SIZEOF_POINTER__ == 8
+#define GOT_R_SYM(info) ELF64_R_SYM (info)
+#define GOT_R_TYPE(info) ELF64_R_TYPE (info)
+#else
+#define GOT_R_SYM(info) ELF32_R_SYM (info)
+#define GOT_R_TYPE(info) ELF32_R_TYPE (info)
+#endif
+
+/* The dynamic section of a loaded object, as needed to find its GOT
+ * entries. */
+typedef struct
+{
+  ElfW(Addr) base;
+  const ElfW(Sym) *symtab;
+  const char *strtab;
+  /* GOT entries in this range are read-only once relocation is done. As in
+   * glibc, both ends are rounded down to a page boundary: the page holding
+   * the end of PT_GNU_RELRO is shared with writable data and left alone. */
+  ElfW(Addr) relro_start;
+  ElfW(Addr) relro_end;
+} GotObject;
+
+/* Protects everything below */
+static GMutex got_mutex;
+static const GObjectListGotHook *got_hooks = NULL;  /* unowned */
+static guint n_got_hooks = 0;
+/* (gpointer *) GOT entry -> original value, for every patched entry */
+static GHashTable *got_patches = NULL;  /* owned */
+
+static void * (* real_dlopen) (const char *filename, int flags) = NULL;
+
+static void *got_dlopen (const char *filename, int flags);
+
+/* Always hooked while installed, so that objects opened later get patched */
+static const GObjectListGotHook got_dlopen_hook = { "dlopen", got_dlopen };
+
+static const GObjectListGotHook *
+got_find_hook (const char *name)
+{
+  guint i;
+
+  if (strcmp (name, got_dlopen_hook.name) == 0)
+    return &got_dlopen_hook;
+
+  for (i = 0; i < n_got_hooks; i++)
+    {
+      if (strcmp (name, got_hooks[i].name) == 0)
+        return &got_hooks[i];
+    }
+
+  return NULL;
+}
+
+/* Current protection of the mapping holding @page, from /proc/self/maps, or
+ * -1 if it cannot be found. */
+static gint
+got_page_protection (gpointer page)
+{
+  FILE *maps;
+  gchar line[512];
+  gint prot = -1;
+
+  maps = fopen ("/proc/self/maps", "re");
+  if (maps == NULL)
+    return -1;
+
+  while (fgets (line, sizeof (line), maps) != NULL)
+    {
+      guintptr start, end;
+      gchar perms[5];
+
+      if (sscanf (line, "%" G_GINTPTR_MODIFIER "x-%" G_GINTPTR_MODIFIER
+              "x %4s", &start, &end, perms) != 3 ||
+          (guintptr) page < start || (guintptr) page >= end)
+        continue;
+
+      prot = (perms[0] == 'r' ? PROT_READ : 0) |
+          (perms[1] == 'w' ? PROT_WRITE : 0) |
+          (perms[2] == 'x' ? PROT_EXEC : 0);
+      break;
+    }
+
+  fclose (maps);
+
+  return prot;
+}
+
+static gboolean
+got_write_entry (const GotObject *object,
+    gpointer *entry,
+    gpointer value)
+{
+  gboolean relro;
+  gsize page_size = 0;
+  gpointer page = NULL;
+  gint prot = -1;
+
+  relro = (ElfW(Addr)) entry >= object->relro_start &&
+      (ElfW(Addr)) entry < object->relro_end;
+
+  if (relro)
+    {
+      page_size = sysconf (_SC_PAGESIZE);
+      page = (gpointer) ((guintptr) entry & ~(guintptr) (page_size - 1));
+      prot = got_page_protection (page);
+
+      if (prot == -1)
+        {
+          g_warning ("Failed to find the protection of GOT entry %p", entry);
+          return FALSE;
+        }
+
+      if (!(prot & PROT_WRITE) &&
+          mprotect (page, page_size, prot | PROT_WRITE) < 0)
+        {
+          g_warning ("Failed to make GOT entry %p writable: %s", entry,
+              g_strerror (errno));
+          return FALSE;
+        }
+    }
+
+  /* Other threads may be calling through the entry at the same time */
+  __atomic_store_n (entry, value, __ATOMIC_RELEASE);
+
+  if (relro && !(prot & PROT_WRITE))
+    mprotect (page, page_size, prot);
+
+  return TRUE;
+}
+
+static void
+got_patch_entry (const GotObject *object,
+    gpointer *entry,
+    const GObjectListGotHook *hook,
+    gboolean restore)
+{
+  gpointer current, original;
+
+  current = __atomic_load_n (entry, __ATOMIC_RELAXED);
+
+  if (restore)
+    {
+      if (current == hook->replacement &&
+          g_hash_table_lookup_extended (got_patches, entry, NULL, &original))
+        got_write_entry (object, entry, original);
+    }
+  else if (current != hook->replacement)
+    {
+      if (got_write_entry (object, entry, hook->replacement))
+        g_hash_table_insert (got_patches, entry, current);
+    }
+}
+
+/* @relocs is a DT_REL or a DT_RELA table; both entry types start with
+ * r_offset and r_info, which is all that is needed. */
+static void
+got_process_relocs (const GotObject *object,
+    ElfW(Addr) relocs,
+    gsize size,
+    gsize entry_size,
+    gboolean restore)
+{
+  gsize offset;
+
+  for (offset = 0; offset + entry_size <= size; offset += entry_size)
+    {
+      const ElfW(Rel) *rel = (const ElfW(Rel) *) (relocs + offset);
+      const GObjectListGotHook *hook;
+      const char *name;
+      guint type;
+
+      type = GOT_R_TYPE (rel->r_info);
+      if ((type != GOT_R_JUMP_SLOT && type != GOT_R_GLOB_DAT) ||
+          GOT_R_SYM (rel->r_info) == 0)
+        continue;
+
+      name = object->strtab + object->symtab[GOT_R_SYM (rel->r_info)].st_name;
+      hook = got_find_hook (name);
+
+      if (hook != NULL)
+        got_patch_entry (object, (gpointer *) (object->base + rel->r_offset),
+            hook, restore);
+    }
+}
+
+/* glibc relocates the pointers in the dynamic section in place on most
+ * architectures, but not all of them. */
+static ElfW(Addr)
+got_dynamic_ptr (const struct dl_phdr_info *info,
+    ElfW(Addr) ptr)
+{
+  return ptr < info->dlpi_addr ? ptr + info->dlpi_addr : ptr;
+}
+
+static int
+got_process_object (struct dl_phdr_info *info,
+    G_GNUC_UNUSED size_t size,
+    void *data)
+{
+  gboolean restore = GPOINTER_TO_INT (data);
+  ElfW(Addr) self = (ElfW(Addr)) got_process_object;
+  const ElfW(Dyn) *dyn = NULL;
+  GotObject object = { info->dlpi_addr, NULL, NULL, 0, 0 };
+  ElfW(Addr) jmprel = 0, rela = 0, rel = 0;
+  gsize jmprel_size = 0, rela_size = 0, rel_size = 0;
+  gsize rela_entry = sizeof (ElfW(Rela)), rel_entry = sizeof (ElfW(Rel));
+  ElfW(Sxword) pltrel = 0;
+  ElfW(Addr) page_mask;
+  guint i;
+
+  for (i = 0; i < info->dlpi_phnum; i++)
+    {
+      const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+      ElfW(Addr) start = info->dlpi_addr + phdr->p_vaddr;
+
+      switch (phdr->p_type)
+        {
+          case PT_LOAD:
+            /* Never patch libgobject-list itself: its own calls to dlopen()
+             * and to the hooked functions must reach the real ones. */
+            if (self >= start && self < start + phdr->p_memsz)
+              return 0;
+            break;
+          case PT_DYNAMIC:
+            dyn = (const ElfW(Dyn) *) start;
+            break;
+          case PT_GNU_RELRO:
+            page_mask = ~(ElfW(Addr)) (sysconf (_SC_PAGESIZE) - 1);
+            object.relro_start = start & page_mask;
+            object.relro_end = (start + phdr->p_memsz) & page_mask;
+            break;
+          default:
+            break;
+        }
+    }
+
+  if (dyn == NULL)
+    return 0;
+
+  for (; dyn->d_tag != DT_NULL; dyn++)
+    {
+      switch (dyn->d_tag)
+        {
+          case DT_SYMTAB:
+            object.symtab =
+                (const ElfW(Sym) *) got_dynamic_ptr (info, dyn->d_un.d_ptr);
+            break;
+          case DT_STRTAB:
+            object.strtab =
+                (const char *) got_dynamic_ptr (info, dyn->d_un.d_ptr);
+            break;
+          case DT_JMPREL:
+            jmprel = got_dynamic_ptr (info, dyn->d_un.d_ptr);
+            break;
+          case DT_PLTRELSZ:
+            jmprel_size = dyn->d_un.d_val;
+            break;
+          case DT_PLTREL:
+            pltrel = dyn->d_un.d_val;
+            break;
+          case DT_RELA:
+            rela = got_dynamic_ptr (info, dyn->d_un.d_ptr);
+            break;
+          case DT_RELASZ:
+            rela_size = dyn->d_un.d_val;
+            break;
+          case DT_RELAENT:
+            rela_entry = dyn->d_un.d_val;
+            break;
+          case DT_REL:
+            rel = got_dynamic_ptr (info, dyn->d_un.d_ptr);
+            break;
+          case DT_RELSZ:
+            rel_size = dyn->d_un.d_val;
+            break;
+          case DT_RELENT:
+            rel_entry = dyn->d_un.d_val;
+            break;
+          default:
+            break;
+        }
+    }
+
+  if (object.symtab == NULL || object.strtab == NULL)
+    return 0;
+
+  if (jmprel != 0)
+    got_process_relocs (&object, jmprel, jmprel_size,
+        pltrel == DT_RELA ? rela_entry : rel_entry, restore);
+  if (rela != 0)
+    got_process_relocs (&object, rela, rela_size, rela_entry, restore);
+  if (rel != 0)
+    got_process_relocs (&object, rel, rel_size, rel_entry, restore);
+
+  return 0;
+}
+
+static void *
+got_dlopen (const char *filename,
+    int flags)
+{
+  void *handle;
+
+  handle = real_dlopen (filename, flags);
+
+  if (handle != NULL)
+    {
+      g_mutex_lock (&got_mutex);
+      if (got_hooks != NULL)
+        dl_iterate_phdr (got_process_object, GINT_TO_POINTER (FALSE));
+      g_mutex_unlock (&got_mutex);
+    }
+
+  return handle;
+}
+
+gboolean
+gobject_list_got_install (const GObjectListGotHook *hooks,
+    guint n_hooks)
+{
+  g_mutex_lock (&got_mutex);
+
+  if (real_dlopen == NULL)
+    real_dlopen = dlsym (RTLD_NEXT, "dlopen");
+  if (got_patches == NULL)
+    got_patches = g_hash_table_new (NULL, NULL);
+
+  got_hooks = hooks;
+  n_got_hooks = n_hooks;
+
+  dl_iterate_phdr (got_process_object, GINT_TO_POINTER (FALSE));
+
+  g_mutex_unlock (&got_mutex);
+
+  return TRUE;
+}
+
+void
+gobject_list_got_uninstall (void)
+{
+  g_mutex_lock (&got_mutex);
+
+  if (got_hooks != NULL)
+    {
+      /* Only objects still loaded are restored; entries of unloaded objects
+       * are simply forgotten. */
+      dl_iterate_phdr (got_process_object, GINT_TO_POINTER (TRUE));
+      g_hash_table_remove_all (got_patches);
+
+      got_hooks = NULL;
+      n_got_hooks = 0;
+    }
+
+  g_mutex_unlock (&got_mutex);
+}
+
+#else /* !GOT_R_JUMP_SLOT */
+
+gboolean
+gobject_list_got_install (G_GNUC_UNUSED const GObjectListGotHook *hooks,
+    G_GNUC_UNUSED guint n_hooks)
+{
+  return FALSE;
+}
+
+void
+gobject_list_got_uninstall (void)
+{
+}
+
+#endif /* GOT_R_JUMP_SLOT */
@@ -0,0 +1,52 @@
+/*
+ * gobject-list: a LD_PRELOAD library for tracking the lifetime of GObjects
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Private interface to the GOT rewriting engine.
+ *
+ * LD_PRELOAD only takes effect for symbols resolved through the global lookup
+ * scope. Libraries opened with RTLD_DEEPBIND, linked with -Bsymbolic or
+ * loaded before the preload took effect can still have their GOT entries
+ * bound directly to GLib and GStreamer. The engine walks every loaded object
+ * and points the GOT entries of the hooked symbols at the replacements
+ * instead, and does so again for each object opened later with dlopen(). */
+
+#ifndef GOBJECT_LIST_GOT_H
+#define GOBJECT_LIST_GOT_H
+
+#include <glib.h>
+
+typedef struct
+{
+  const char *name;
+  gpointer replacement;
+} GObjectListGotHook;
+
+/* Patch the GOT entries for @hooks, which must stay valid until
+ * gobject_list_got_uninstall(), in every loaded object except
+ * libgobject-list itself. Returns FALSE if GOT rewriting is not supported on
+ * this platform. */
+gboolean gobject_list_got_install (const GObjectListGotHook *hooks,
+    guint n_hooks);
+
+/* Restore every GOT entry patched since gobject_list_got_install(). */
+void gobject_list_got_uninstall (void);
+
+#endif /* GOBJECT_LIST_GOT_H */
@@ -0,0 +1,134 @@
+/*
+ * gobject-list: a LD_PRELOAD library for tracking the lifetime of GObjects
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Layout of the shared memory segment published by gobject-list when
+ * GOBJECT_LIST_SHM is set. The segment is written by the traced process only
+ * and may be mapped read-only by any number of external readers, including
+ * after the traced process has crashed.
+ *
+ * The segment starts with a GObjectListShmHeader, followed by
+ * GOBJECT_LIST_SHM_MAX_TYPES GObjectListShmType entries at @types_offset and
+ * @max_objects GObjectListShmObject entries at @objects_offset. Only plain
+ * fixed-size integers are used so that a reader built against a different
+ * GLib can still parse it.
+ *
+ * When sampling, the per-type counters are estimates scaled by the sampling
+ * rate, while the object table only lists the objects actually tracked.
+ *
+ * Consistency is provided by a sequence lock: the writer increments @seq
+ * before and after every update, so a reader must retry its copy if @seq was
+ * odd or changed while it was copying. */
+
+#ifndef GOBJECT_LIST_SHM_H
+#define GOBJECT_LIST_SHM_H
+
+#include <stdint.h>
+
+#define GOBJECT_LIST_SHM_MAGIC 0x4c424f47u  /* "GOBL" */
+#define GOBJECT_LIST_SHM_VERSION 2
+#define GOBJECT_LIST_SHM_MAX_TYPES 2048
+#define GOBJECT_LIST_SHM_TYPE_NAME_LEN 96
+
+/* Default segment name, formatted with the PID of the traced process. The
+ * segment then shows up as /dev/shm/gobject-list-<pid>. */
+#define GOBJECT_LIST_SHM_NAME_FORMAT "/gobject-list-%d"
+
+typedef struct
+{
+  char name[GOBJECT_LIST_SHM_TYPE_NAME_LEN];
+  uint64_t live;
+  uint64_t created;
+  uint64_t finalized;
+  uint64_t live_bytes;
+} GObjectListShmType;
+
+typedef struct
+{
+  uint64_t address;  /* 0 if the slot is free */
+  uint64_t serial;
+  uint32_t type_index;
+  uint32_t padding;
+} GObjectListShmObject;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  int32_t pid;
+
+  uint64_t start_time;  /* wall clock time in µs when tracing started */
+  uint64_t update_time;  /* wall clock time in µs of the last update */
+
+  uint32_t types_offset;
+  uint32_t n_types;
+  uint64_t overflow_types;  /* types which did not fit in the table */
+
+  uint32_t objects_offset;
+  uint32_t max_objects;  /* 0 if the object table is disabled */
+  uint32_t n_object_slots;  /* high-water mark of used object slots */
+  uint32_t sample_rate;  /* 1 in this many objects is tracked */
+  uint64_t n_objects;
+  uint64_t overflow_objects;  /* live objects which did not fit */
+} GObjectListShmHeader;
+
+static inline GObjectListShmType *
+gobject_list_shm_get_types (const GObjectListShmHeader *header)
+{
+  return (GObjectListShmType *) ((char *) header + header->types_offset);
+}
+
+static inline GObjectListShmObject *
+gobject_list_shm_get_objects (const GObjectListShmHeader *header)
+{
+  return (GObjectListShmObject *) ((char *) header + header->objects_offset);
+}
+
+static inline uint32_t
+gobject_list_shm_read_begin (const GObjectListShmHeader *header)
+{
+  return __atomic_load_n (&header->seq, __ATOMIC_ACQUIRE);
+}
+
+/* Returns non-zero if the data copied since gobject_list_shm_read_begin()
+ * may be torn and must be read again. */
+static inline int
+gobject_list_shm_read_retry (const GObjectListShmHeader *header,
+    uint32_t seq)
+{
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  return (seq & 1) || __atomic_load_n (&header->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void
+gobject_list_shm_write_begin (GObjectListShmHeader *header)
+{
+  __atomic_store_n (&header->seq, header->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static inline void
+gobject_list_shm_write_end (GObjectListShmHeader *header)
+{
+  __atomic_store_n (&header->seq, header->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* GOBJECT_LIST_SHM_H */
@@ -0,0 +1,433 @@
+/*
+ * gobject-list-top: live per-type view of a process traced by gobject-list
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include <glib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gobject-list-shm.h"
+
+/* Number of attempts at getting a consistent copy of the segment before
+ * giving up and displaying a possibly torn one. This happens if the traced
+ * process crashed in the middle of an update. */
+#define MAX_READ_ATTEMPTS 1000
+
+typedef enum
+{
+  SORT_LIVE,
+  SORT_BYTES,
+  SORT_CREATED_RATE,
+  SORT_FINALIZED_RATE,
+  SORT_GROWTH,
+} SortKey;
+
+typedef struct
+{
+  const gchar *name;
+  SortKey key;
+} SortKeyMapItem;
+
+static const SortKeyMapItem sort_key_map[] =
+{
+  { "live", SORT_LIVE },
+  { "bytes", SORT_BYTES },
+  { "created", SORT_CREATED_RATE },
+  { "finalized", SORT_FINALIZED_RATE },
+  { "growth", SORT_GROWTH },
+};
+
+typedef struct
+{
+  const gchar *name;  /* unowned; points into the current snapshot */
+  guint64 live;
+  guint64 live_bytes;
+  gdouble created_rate;  /* objects per second since the last refresh */
+  gdouble finalized_rate;
+  gint64 delta;  /* live count change since the last refresh */
+  gint64 growth;  /* live count change since the first refresh */
+} Row;
+
+typedef struct
+{
+  GObjectListShmHeader *header;  /* owned; private copy */
+  gint64 time;  /* monotonic time the copy was taken */
+  gboolean consistent;
+} Snapshot;
+
+static gint interval_ms = 1000;
+static gint max_rows = 0;
+static gchar *sort_name = NULL;
+static gboolean once = FALSE;
+
+static const GOptionEntry entries[] =
+{
+  { "interval", 'i', 0, G_OPTION_ARG_INT, &interval_ms,
+    "Refresh interval in milliseconds (default: 1000)", "MS" },
+  { "rows", 'n', 0, G_OPTION_ARG_INT, &max_rows,
+    "Maximum number of types to show (default: fit the terminal)", "N" },
+  { "sort", 's', 0, G_OPTION_ARG_STRING, &sort_name,
+    "Sort by live, bytes, created, finalized or growth (default: live)",
+    "KEY" },
+  { "once", '1', 0, G_OPTION_ARG_NONE, &once,
+    "Print a single refresh without clearing the screen, then exit", NULL },
+  { NULL, }
+};
+
+static GObjectListShmHeader *
+map_segment (const gchar *name,
+    gsize *size)
+{
+  GObjectListShmHeader *header;
+  struct stat st;
+  gpointer mem;
+  gint fd;
+
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0)
+    {
+      g_printerr ("Failed to open shared memory segment %s: %s\n"
+          "Is the process running with GOBJECT_LIST_SHM=1?\n",
+          name, g_strerror (errno));
+      return NULL;
+    }
+
+  if (fstat (fd, &st) < 0 || (gsize) st.st_size < sizeof (*header))
+    {
+      g_printerr ("Invalid shared memory segment %s\n", name);
+      close (fd);
+      return NULL;
+    }
+
+  mem = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (mem == MAP_FAILED)
+    {
+      g_printerr ("Failed to map shared memory segment %s: %s\n", name,
+          g_strerror (errno));
+      return NULL;
+    }
+
+  header = mem;
+
+  if (__atomic_load_n (&header->magic, __ATOMIC_ACQUIRE) !=
+          GOBJECT_LIST_SHM_MAGIC ||
+      header->version != GOBJECT_LIST_SHM_VERSION)
+    {
+      g_printerr ("Shared memory segment %s has an unsupported format\n",
+          name);
+      munmap (mem, st.st_size);
+      return NULL;
+    }
+
+  *size = st.st_size;
+  return header;
+}
+
+/* Copy the header and type table. The object table is not needed here and is
+ * skipped to keep the copy cheap. */
+static void
+take_snapshot (const GObjectListShmHeader *header,
+    Snapshot *snapshot)
+{
+  gsize size = header->types_offset +
+      GOBJECT_LIST_SHM_MAX_TYPES * sizeof (GObjectListShmType);
+  guint attempt;
+
+  if (snapshot->header == NULL)
+    snapshot->header = g_malloc (size);
+
+  for (attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++)
+    {
+      guint32 seq = gobject_list_shm_read_begin (header);
+
+      memcpy (snapshot->header, header, size);
+
+      if (!gobject_list_shm_read_retry (header, seq))
+        break;
+
+      g_usleep (10);
+    }
+
+  snapshot->consistent = (attempt < MAX_READ_ATTEMPTS);
+  snapshot->time = g_get_monotonic_time ();
+}
+
+static gint
+compare_rows (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const Row *ra = a, *rb = b;
+  SortKey key = GPOINTER_TO_INT (user_data);
+  gdouble va = 0, vb = 0;
+
+  switch (key)
+    {
+    case SORT_LIVE:
+      va = ra->live;
+      vb = rb->live;
+      break;
+    case SORT_BYTES:
+      va = ra->live_bytes;
+      vb = rb->live_bytes;
+      break;
+    case SORT_CREATED_RATE:
+      va = ra->created_rate;
+      vb = rb->created_rate;
+      break;
+    case SORT_FINALIZED_RATE:
+      va = ra->finalized_rate;
+      vb = rb->finalized_rate;
+      break;
+    case SORT_GROWTH:
+      va = ra->growth;
+      vb = rb->growth;
+      break;
+    }
+
+  if (va != vb)
+    return (va < vb) ? 1 : -1;
+
+  return g_strcmp0 (ra->name, rb->name);
+}
+
+static guint
+get_terminal_rows (void)
+{
+  const gchar *lines = g_getenv ("LINES");
+
+  if (lines != NULL && atoi (lines) > 0)
+    return atoi (lines);
+
+  return 24;
+}
+
+/* The process may belong to another user, in which case kill() fails with
+ * EPERM even though it is still running. */
+static gboolean
+process_is_alive (gint pid)
+{
+  return kill (pid, 0) == 0 || errno == EPERM;
+}
+
+static void
+display (const Snapshot *current,
+    const Snapshot *previous,
+    const Snapshot *first,
+    SortKey key,
+    gboolean alive)
+{
+  const GObjectListShmHeader *header = current->header;
+  const GObjectListShmType *types = gobject_list_shm_get_types (header);
+  const GObjectListShmType *prev_types = NULL, *first_types = NULL;
+  gdouble elapsed = 0;
+  guint64 total_live = 0, total_bytes = 0;
+  GArray *rows;
+  guint n_types, n_shown, i;
+
+  n_types = MIN (header->n_types, GOBJECT_LIST_SHM_MAX_TYPES);
+
+  if (previous->header != NULL)
+    {
+      prev_types = gobject_list_shm_get_types (previous->header);
+      elapsed = (current->time - previous->time) / (gdouble) G_USEC_PER_SEC;
+    }
+  if (first->header != NULL)
+    first_types = gobject_list_shm_get_types (first->header);
+
+  rows = g_array_sized_new (FALSE, TRUE, sizeof (Row), n_types);
+
+  for (i = 0; i < n_types; i++)
+    {
+      Row row = { 0, };
+
+      row.name = types[i].name;
+      row.live = types[i].live;
+      row.live_bytes = types[i].live_bytes;
+
+      if (prev_types != NULL && i < previous->header->n_types)
+        {
+          if (elapsed > 0)
+            {
+              row.created_rate =
+                  (types[i].created - prev_types[i].created) / elapsed;
+              row.finalized_rate =
+                  (types[i].finalized - prev_types[i].finalized) / elapsed;
+            }
+          row.delta = (gint64) types[i].live - (gint64) prev_types[i].live;
+        }
+
+      if (first_types != NULL && i < first->header->n_types)
+        row.growth = (gint64) types[i].live - (gint64) first_types[i].live;
+      else
+        row.growth = types[i].live;
+
+      total_live += row.live;
+      total_bytes += row.live_bytes;
+
+      g_array_append_val (rows, row);
+    }
+
+  g_array_sort_with_data (rows, compare_rows, GINT_TO_POINTER (key));
+
+  if (!once)
+    g_print ("\033[H\033[2J");
+
+  g_print ("gobject-list-top — pid %d%s%s   types: %u%s   live: %"
+      G_GUINT64_FORMAT "   bytes: %" G_GUINT64_FORMAT "\n",
+      header->pid, alive ? "" : " (exited)",
+      current->consistent ? "" : " (inconsistent)",
+      n_types, header->overflow_types > 0 ? "+" : "",
+      total_live, total_bytes);
+  if (header->sample_rate > 1)
+    g_print ("Sampling 1 in %u objects; counts are estimates\n",
+        header->sample_rate);
+  g_print ("%-40s %10s %12s %10s %10s %8s %10s\n", "TYPE", "LIVE", "BYTES",
+      "CREATED/s", "FINAL/s", "DELTA", "GROWTH");
+
+  if (max_rows > 0)
+    n_shown = max_rows;
+  else if (once)
+    n_shown = rows->len;
+  else
+    n_shown = MAX (get_terminal_rows (), 4) - 3;
+
+  for (i = 0; i < rows->len && i < n_shown; i++)
+    {
+      const Row *row = &g_array_index (rows, Row, i);
+
+      g_print ("%-40.40s %10" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT
+          " %10.1f %10.1f %+8" G_GINT64_FORMAT " %+10" G_GINT64_FORMAT "\n",
+          row->name, row->live, row->live_bytes, row->created_rate,
+          row->finalized_rate, row->delta, row->growth);
+    }
+
+  g_array_free (rows, TRUE);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GObjectListShmHeader *header;
+  Snapshot first = { NULL, }, previous = { NULL, }, current = { NULL, };
+  SortKey key = SORT_LIVE;
+  gchar *name;
+  gsize size;
+  gint pid;
+
+  context = g_option_context_new ("PID");
+  g_option_context_set_summary (context,
+      "Show live per-type object counts of a process running with\n"
+      "LD_PRELOAD=libgobject-list.so and GOBJECT_LIST_SHM=1.");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: %s [OPTION…] PID|SEGMENT\n", argv[0]);
+      return 1;
+    }
+
+  if (sort_name != NULL)
+    {
+      guint i;
+
+      for (i = 0; i < G_N_ELEMENTS (sort_key_map); i++)
+        {
+          if (!g_ascii_strcasecmp (sort_name, sort_key_map[i].name))
+            break;
+        }
+
+      if (i == G_N_ELEMENTS (sort_key_map))
+        {
+          g_printerr ("Unknown sort key: %s\n", sort_name);
+          return 1;
+        }
+
+      key = sort_key_map[i].key;
+    }
+
+  if (argv[1][0] == '/')
+    name = g_strdup (argv[1]);
+  else
+    name = g_strdup_printf (GOBJECT_LIST_SHM_NAME_FORMAT, atoi (argv[1]));
+
+  header = map_segment (name, &size);
+  g_free (name);
+
+  if (header == NULL)
+    return 1;
+
+  pid = header->pid;
+  interval_ms = MAX (interval_ms, 10);
+
+  take_snapshot (header, &first);
+
+  if (once)
+    {
+      /* Measure rates over a single interval. */
+      g_usleep (interval_ms * 1000);
+      take_snapshot (header, &current);
+      display (&current, &first, &first, key, process_is_alive (pid));
+      return 0;
+    }
+
+  while (TRUE)
+    {
+      gboolean alive = process_is_alive (pid);
+      Snapshot tmp;
+
+      take_snapshot (header, &current);
+      display (&current, &previous, &first, key, alive);
+
+      if (!alive)
+        break;
+
+      /* Swap the buffers to keep the previous refresh for the rates. */
+      tmp = previous;
+      previous = current;
+      current = tmp;
+
+      g_usleep (interval_ms * 1000);
+    }
+
+  munmap (header, size);
+
+  return 0;
+}
@@ -0,0 +1,587 @@
+/*
+ * gobject-list: a LD_PRELOAD library for tracking the lifetime of GObjects
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#define _GNU_SOURCE
+
+#include "gobject-list-trampoline.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined (__x86_64__) || defined (__aarch64__)
+
+/* Each patched function gets a page within direct branch range of its entry,
+ * holding a relay which jumps to the replacement, followed by the
+ * trampoline. The entry is patched once with a single direct branch to the
+ * relay, written with one atomic store, and only functions whose patch fits
+ * in one aligned 8-byte word are patched. The relay jumps through an aligned
+ * absolute address, which is what uninstalling and installing again switch
+ * between the replacement and the trampoline: the code of the entry is never
+ * rewritten while other threads may be running it. */
+#if defined (__x86_64__)
+#define PATCH_SIZE 5  /* jmp rel32 */
+#define BRANCH_RANGE (G_GINT64_CONSTANT (1) << 31)
+#define MAX_MOVED 32
+#else
+#define PATCH_SIZE 4  /* b imm26 */
+#define BRANCH_RANGE (G_GINT64_CONSTANT (1) << 27)
+#define MAX_MOVED 4
+#endif
+
+#define RELAY_SIZE 16
+/* Offset in the relay of the address it jumps to */
+#define RELAY_ADDRESS 8
+#define MAX_TRAMPOLINES 16
+
+typedef struct
+{
+  guint8 *target;
+  guint8 *page;  /* relay, then trampoline */
+  gboolean installed;  /* whether the relay jumps to the replacement */
+} Trampoline;
+
+static GMutex trampoline_mutex;
+/* Entries are only appended, and published by incrementing @n_trampolines,
+ * so that gobject_list_trampoline_get_original() can read them without the
+ * lock. */
+static Trampoline trampolines[MAX_TRAMPOLINES];
+static volatile gint n_trampolines = 0;
+
+#if defined (__x86_64__)
+
+/* Length of a ModRM byte with its SIB byte and displacement, or 0 if it
+ * addresses memory relative to RIP. */
+static guint
+modrm_length (const guint8 *code)
+{
+  guint mod = code[0] >> 6, rm = code[0] & 7, len = 1;
+
+  if (mod == 3)
+    return 1;
+
+  if (rm == 4)
+    {
+      len++;
+      if (mod == 0 && (code[1] & 7) == 5)
+        len += 4;
+    }
+  else if (mod == 0 && rm == 5)
+    {
+      return 0;
+    }
+
+  if (mod == 1)
+    len += 1;
+  else if (mod == 2)
+    len += 4;
+
+  return len;
+}
+
+/* Length of the instruction at @code if it can be moved by move_insn(), or 0
+ * otherwise. Only the instructions found in typical function prologues are
+ * known; anything else, including RIP-relative memory accesses, is
+ * refused. */
+static guint
+insn_length (const guint8 *code)
+{
+  const guint8 *p = code;
+  gboolean rex_w = FALSE, opsize = FALSE;
+  guint len;
+
+  /* endbr64 */
+  if (p[0] == 0xf3 && p[1] == 0x0f && p[2] == 0x1e && p[3] == 0xfa)
+    return 4;
+
+  if (*p == 0x66)
+    {
+      opsize = TRUE;
+      p++;
+    }
+  if ((*p & 0xf0) == 0x40)
+    {
+      rex_w = (*p & 0x08) != 0;
+      p++;
+    }
+
+  /* push, pop, nop */
+  if ((*p >= 0x50 && *p <= 0x5f) || *p == 0x90)
+    return p + 1 - code;
+
+  /* relative branches, see move_insn() */
+  if (p == code && ((*p >= 0x70 && *p <= 0x7f) || *p == 0xeb))
+    return 2;
+  if (p == code && (*p == 0xe8 || *p == 0xe9))
+    return 5;
+  if (p == code && p[0] == 0x0f && p[1] >= 0x80 && p[1] <= 0x8f)
+    return 6;
+
+  /* mov reg, imm */
+  if (*p >= 0xb8 && *p <= 0xbf)
+    return p + 1 + (rex_w ? 8 : (opsize ? 2 : 4)) - code;
+
+  switch (*p)
+    {
+      /* ALU, test, xchg, mov and lea between a register and r/m */
+      case 0x01: case 0x03: case 0x09: case 0x0b: case 0x21: case 0x23:
+      case 0x29: case 0x2b: case 0x31: case 0x33: case 0x39: case 0x3b:
+      case 0x84: case 0x85: case 0x87: case 0x88: case 0x89: case 0x8a:
+      case 0x8b: case 0x8d:
+        len = modrm_length (p + 1);
+        return len ? p + 1 + len - code : 0;
+      /* ALU, shift and imul with an 8-bit immediate */
+      case 0x6b: case 0x83: case 0xc1:
+        len = modrm_length (p + 1);
+        return len ? p + 1 + len + 1 - code : 0;
+      /* ALU, imul and mov with a 16 or 32-bit immediate */
+      case 0x69: case 0x81: case 0xc7:
+        len = modrm_length (p + 1);
+        return len ? p + 1 + len + (opsize ? 2 : 4) - code : 0;
+      /* multi-byte nop */
+      case 0x0f:
+        if (p[1] != 0x1f)
+          return 0;
+        len = modrm_length (p + 2);
+        return len ? p + 2 + len - code : 0;
+      default:
+        return 0;
+    }
+}
+
+/* Write to @code a branch which jumps to @to when executed at @pc */
+static void
+write_branch (guint8 *code,
+    const guint8 *pc,
+    const guint8 *to)
+{
+  gint32 offset = to - (pc + 5);
+
+  code[0] = 0xe9;
+  memcpy (code + 1, &offset, sizeof (offset));
+}
+
+/* Copy the instruction of @len bytes at @insn, which is to be patched at
+ * @entry, to @code, rewriting relative branches as their rel32 forms so that
+ * they still reach their original target. Returns the number of bytes
+ * written, or 0 if the branch target is out of range or overwritten by the
+ * patch. */
+static guint
+move_insn (guint8 *code,
+    const guint8 *entry,
+    const guint8 *insn,
+    guint len)
+{
+  const guint8 *to;
+  guint8 opcode[2];
+  guint n_opcode;
+  gint64 offset;
+  gint32 offset32;
+
+  if ((insn[0] >= 0x70 && insn[0] <= 0x7f) || insn[0] == 0xeb)
+    {
+      to = insn + 2 + (gint8) insn[1];
+      if (insn[0] == 0xeb)
+        {
+          opcode[0] = 0xe9;
+          n_opcode = 1;
+        }
+      else
+        {
+          opcode[0] = 0x0f;
+          opcode[1] = 0x80 + (insn[0] & 0x0f);
+          n_opcode = 2;
+        }
+    }
+  else if (insn[0] == 0xe8 || insn[0] == 0xe9 ||
+      (insn[0] == 0x0f && insn[1] >= 0x80 && insn[1] <= 0x8f))
+    {
+      n_opcode = len - 4;
+      memcpy (&offset32, insn + n_opcode, sizeof (offset32));
+      to = insn + len + offset32;
+      memcpy (opcode, insn, n_opcode);
+    }
+  else
+    {
+      memcpy (code, insn, len);
+      return len;
+    }
+
+  offset = to - (code + n_opcode + 4);
+  if (offset != (gint32) offset || (to >= entry && to < entry + PATCH_SIZE))
+    return 0;
+
+  offset32 = offset;
+  memcpy (code, opcode, n_opcode);
+  memcpy (code + n_opcode, &offset32, sizeof (offset32));
+
+  return n_opcode + 4;
+}
+
+/* jmp *2(%rip), followed by padding and the absolute address, which is thus
+ * 8-byte aligned */
+static void
+write_relay (guint8 *relay)
+{
+  static const guint8 jmp[] = { 0xff, 0x25, 0x02, 0x00, 0x00, 0x00,
+      0x90, 0x90 };
+
+  memcpy (relay, jmp, sizeof (jmp));
+}
+
+#else /* __aarch64__ */
+
+/* Whether @insn computes an address relative to the PC, and so cannot be
+ * executed at another address unchanged. */
+static gboolean
+insn_is_pc_relative (guint32 insn)
+{
+  return (insn & 0x1f000000) == 0x10000000 ||  /* adr, adrp */
+      (insn & 0x7c000000) == 0x14000000 ||  /* b, bl */
+      (insn & 0xff000010) == 0x54000000 ||  /* b.cond */
+      (insn & 0x7e000000) == 0x34000000 ||  /* cbz, cbnz */
+      (insn & 0x7e000000) == 0x36000000 ||  /* tbz, tbnz */
+      (insn & 0x3b000000) == 0x18000000;  /* ldr, ldrsw, prfm (literal) */
+}
+
+static guint
+insn_length (const guint8 *code)
+{
+  guint32 insn;
+
+  memcpy (&insn, code, sizeof (insn));
+
+  return insn_is_pc_relative (insn) ? 0 : 4;
+}
+
+static guint
+move_insn (guint8 *code,
+    G_GNUC_UNUSED const guint8 *entry,
+    const guint8 *insn,
+    guint len)
+{
+  memcpy (code, insn, len);
+
+  return len;
+}
+
+static void
+write_branch (guint8 *code,
+    const guint8 *pc,
+    const guint8 *to)
+{
+  guint32 insn = 0x14000000 | (((to - pc) >> 2) & 0x03ffffff);
+
+  memcpy (code, &insn, sizeof (insn));
+}
+
+/* ldr x16, #8; br x16, followed by the absolute address. x16 is the
+ * intra-procedure-call scratch register, free to clobber at a function entry,
+ * and "bti c" landing pads accept br through it. */
+static void
+write_relay (guint8 *relay)
+{
+  static const guint32 insns[] = { 0x58000050, 0xd61f0200 };
+
+  memcpy (relay, insns, sizeof (insns));
+}
+
+#endif
+
+/* Map a page within direct branch range of @target. */
+static guint8 *
+alloc_near (const guint8 *target)
+{
+  gsize page_size = sysconf (_SC_PAGESIZE);
+  guintptr base = (guintptr) target & ~(guintptr) (page_size - 1);
+  gint64 distance;
+
+  for (distance = page_size; distance < BRANCH_RANGE - (gint64) page_size;
+       distance += 1024 * page_size)
+    {
+      guint i;
+
+      for (i = 0; i < 2; i++)
+        {
+          guintptr hint = i == 0 ? base - distance : base + distance;
+          guint8 *page;
+          gint64 offset;
+
+          page = mmap ((gpointer) hint, page_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+          if (page == MAP_FAILED)
+            continue;
+
+          offset = page - target;
+          if (ABS (offset) < BRANCH_RANGE - (gint64) page_size)
+            return page;
+
+          munmap (page, page_size);
+        }
+    }
+
+  return NULL;
+}
+
+/* Whether a patch at @target fits in one aligned 8-byte word */
+static gboolean
+can_patch_atomically (gconstpointer target)
+{
+  return ((guintptr) target & 7) + PATCH_SIZE <= 8;
+}
+
+/* Store the first PATCH_SIZE bytes of @code at @target with one atomic store,
+ * so that other threads never run a torn instruction; @target must pass
+ * can_patch_atomically(). A thread which already ran part of the first
+ * PATCH_SIZE bytes, e.g. an endbr64, can still resume in the middle of the
+ * branch, which is why entries are only ever patched once. Returns FALSE if
+ * the code could not be made writable. */
+static gboolean
+write_code (guint8 *target,
+    const guint8 *code)
+{
+  gsize page_size = sysconf (_SC_PAGESIZE);
+  guintptr start = (guintptr) target & ~(guintptr) (page_size - 1);
+  guintptr end = ((guintptr) target + 8 + page_size - 1) &
+      ~(guintptr) (page_size - 1);
+  guint64 *word = (guint64 *) ((guintptr) target & ~(guintptr) 7);
+  guint offset = target - (guint8 *) word;
+  guint64 value;
+
+  g_assert (can_patch_atomically (target));
+
+  if (mprotect ((gpointer) start, end - start,
+          PROT_READ | PROT_WRITE | PROT_EXEC) < 0)
+    {
+      g_warning ("Failed to make %p writable: %s", target, g_strerror (errno));
+      return FALSE;
+    }
+
+  value = *word;
+  memcpy ((guint8 *) &value + offset, code, PATCH_SIZE);
+  __atomic_store_n (word, value, __ATOMIC_SEQ_CST);
+
+  __builtin___clear_cache ((char *) target, (char *) target + PATCH_SIZE);
+  mprotect ((gpointer) start, end - start, PROT_READ | PROT_EXEC);
+
+  return TRUE;
+}
+
+static Trampoline *
+find_trampoline (gconstpointer target)
+{
+  gint i, n = g_atomic_int_get (&n_trampolines);
+
+  for (i = 0; i < n; i++)
+    {
+      if (trampolines[i].target == target)
+        return &trampolines[i];
+    }
+
+  return NULL;
+}
+
+/* Point the relay of @trampoline at @to. The address is data, so one atomic
+ * store switches callers over without any instruction being rewritten. */
+static gboolean
+set_relay (Trampoline *trampoline,
+    gpointer to)
+{
+  gsize page_size = sysconf (_SC_PAGESIZE);
+
+  if (mprotect (trampoline->page, page_size,
+          PROT_READ | PROT_WRITE | PROT_EXEC) < 0)
+    {
+      g_warning ("Failed to make the relay for %p writable: %s",
+          trampoline->target, g_strerror (errno));
+      return FALSE;
+    }
+
+  __atomic_store_n ((gpointer *) (trampoline->page + RELAY_ADDRESS), to,
+      __ATOMIC_SEQ_CST);
+  mprotect (trampoline->page, page_size, PROT_READ | PROT_EXEC);
+
+  return TRUE;
+}
+
+/* Fill in @page with the relay, pointing at @replacement, and the trampoline
+ * for @target. */
+static gboolean
+build_trampoline (guint8 *target,
+    guint8 *page,
+    gpointer replacement)
+{
+  gsize page_size = sysconf (_SC_PAGESIZE);
+  guint8 *code = page + RELAY_SIZE;
+  guint moved = 0;
+
+  /* The moved instructions must not be branch targets within the function
+   * either; prologues practically never are. */
+  while (moved < PATCH_SIZE)
+    {
+      guint len = insn_length (target + moved);
+      guint written = 0;
+
+      if (len > 0 && moved + len <= MAX_MOVED)
+        written = move_insn (code, target, target + moved, len);
+
+      if (written == 0)
+        {
+          g_warning ("Cannot move the instruction at %p", target + moved);
+          return FALSE;
+        }
+
+      code += written;
+      moved += len;
+    }
+
+  write_relay (page);
+  memcpy (page + RELAY_ADDRESS, &replacement, sizeof (replacement));
+  write_branch (code, code, target + moved);
+
+  if (mprotect (page, page_size, PROT_READ | PROT_EXEC) < 0)
+    return FALSE;
+
+  __builtin___clear_cache ((char *) page, (char *) page + page_size);
+
+  return TRUE;
+}
+
+gboolean
+gobject_list_trampoline_install (gpointer target,
+    gpointer replacement)
+{
+  Trampoline *trampoline;
+  guint8 patch[PATCH_SIZE];
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&trampoline_mutex);
+
+  trampoline = find_trampoline (target);
+
+  if (trampoline == NULL)
+    {
+      guint8 *page;
+
+      if (n_trampolines >= MAX_TRAMPOLINES)
+        {
+          g_warning ("Too many trampolines");
+          goto done;
+        }
+
+      if (!can_patch_atomically (target))
+        {
+          g_warning ("Cannot patch %p with a single atomic store", target);
+          goto done;
+        }
+
+      page = alloc_near (target);
+      if (page == NULL)
+        {
+          g_warning ("No memory within branch range of %p", target);
+          goto done;
+        }
+
+      if (!build_trampoline (target, page, replacement))
+        {
+          munmap (page, sysconf (_SC_PAGESIZE));
+          goto done;
+        }
+
+      write_branch (patch, target, page);
+      if (!write_code (target, patch))
+        {
+          munmap (page, sysconf (_SC_PAGESIZE));
+          goto done;
+        }
+
+      trampoline = &trampolines[n_trampolines];
+      trampoline->target = target;
+      trampoline->page = page;
+      trampoline->installed = TRUE;
+
+      g_atomic_int_inc (&n_trampolines);
+    }
+  else if (!trampoline->installed)
+    {
+      trampoline->installed = set_relay (trampoline, replacement);
+    }
+
+  ret = trampoline->installed;
+
+done:
+  g_mutex_unlock (&trampoline_mutex);
+
+  return ret;
+}
+
+gpointer
+gobject_list_trampoline_get_original (gpointer target)
+{
+  Trampoline *trampoline = find_trampoline (target);
+
+  /* Still valid once uninstalled: it runs the same code */
+  return trampoline != NULL ? trampoline->page + RELAY_SIZE : target;
+}
+
+void
+gobject_list_trampoline_uninstall (void)
+{
+  gint i;
+
+  g_mutex_lock (&trampoline_mutex);
+
+  for (i = 0; i < n_trampolines; i++)
+    {
+      Trampoline *trampoline = &trampolines[i];
+
+      if (trampoline->installed &&
+          set_relay (trampoline, trampoline->page + RELAY_SIZE))
+        trampoline->installed = FALSE;
+    }
+
+  g_mutex_unlock (&trampoline_mutex);
+}
+
+#else /* !__x86_64__ && !__aarch64__ */
+
+gboolean
+gobject_list_trampoline_install (gpointer target,
+    G_GNUC_UNUSED gpointer replacement)
+{
+  g_warning ("Cannot patch %p: trampolines are not supported on this "
+      "platform", target);
+
+  return FALSE;
+}
+
+gpointer
+gobject_list_trampoline_get_original (gpointer target)
+{
+  return target;
+}
+
+void
+gobject_list_trampoline_uninstall (void)
+{
+}
+
+#endif
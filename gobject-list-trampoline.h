@@ -0,0 +1,61 @@
+/*
+ * gobject-list: a LD_PRELOAD library for tracking the lifetime of GObjects
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Private interface to inline trampoline hooking.
+ *
+ * GLib and GStreamer are linked with -Bsymbolic-functions, so their calls to
+ * their own functions are direct and go through neither LD_PRELOAD nor any
+ * GOT entry. To see those, the entry of the hooked function itself is
+ * overwritten with a jump to the replacement. The instructions overwritten
+ * are copied to a trampoline, which then continues into the rest of the
+ * function; calling the trampoline is equivalent to calling the original
+ * function.
+ *
+ * Only x86-64 and aarch64 are supported, and only functions whose first
+ * instructions can be moved and whose patch can be written with a single
+ * atomic store: a function starting with a PC-relative instruction, or whose
+ * patch would straddle an 8-byte boundary, is left alone.
+ *
+ * A thread running the first few bytes of a function at the very moment it
+ * is patched could still resume in the middle of the new branch, so each
+ * entry is patched only once; uninstalling and installing again redirect a
+ * relay the entry branches to instead. */
+
+#ifndef GOBJECT_LIST_TRAMPOLINE_H
+#define GOBJECT_LIST_TRAMPOLINE_H
+
+#include <glib.h>
+
+/* Redirect every call to @target to @replacement. Returns FALSE, after
+ * printing a warning, if @target cannot be patched. */
+gboolean gobject_list_trampoline_install (gpointer target,
+    gpointer replacement);
+
+/* Returns the trampoline which calls the original code of @target, or
+ * @target itself if it is not patched. */
+gpointer gobject_list_trampoline_get_original (gpointer target);
+
+/* Make every patched function run its original code again. The entries stay
+ * patched, and the trampolines are never freed, as other threads may still be
+ * running them. */
+void gobject_list_trampoline_uninstall (void);
+
+#endif /* GOBJECT_LIST_TRAMPOLINE_H */
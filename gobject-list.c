@@ -22,17 +22,32 @@
  *     Danielle Madeley  <danielle.madeley@collabora.co.uk>
  *     Philip Withnall  <philip.withnall@collabora.co.uk>
  */
+#define _GNU_SOURCE
+
 #include <glib-object.h>
 #include <gst/gst.h>
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gobject-list.h"
+#include "gobject-list-got.h"
+#include "gobject-list-shm.h"
+#include "gobject-list-trampoline.h"
 
 #ifdef HAVE_LIBUNWIND
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
+#else
+#include <execinfo.h>
 #endif
 
 typedef enum
@@ -61,8 +76,124 @@ DisplayFlagsMapItem display_flags_map[] =
   { "all", DISPLAY_FLAG_ALL },
 };
 
+/* How suppressions apply to the objects of a type */
+typedef enum
+{
+  SUPPRESS_NONE,
+  SUPPRESS_ALL,
+  SUPPRESS_BY_STACK,  /* depends on the creation stack */
+} SuppressMode;
+
+/* Per-type counters, kept for every type which has had at least one object
+ * tracked. When sampling, each tracked object is counted with its weight, so
+ * the counters are estimates of the totals. */
+typedef struct
+{
+  GType type;
+  const gchar *name;  /* unowned; type names are never freed */
+  guint64 live;
+  guint64 created;
+  guint64 finalized;
+  guint64 live_bytes;
+  gint shm_index;  /* -1 if not published in the shared memory segment */
+
+  /* Counters as of the last time series sample */
+  guint64 sampled_created;
+  guint64 sampled_finalized;
+
+  /* Live objects when gobject_list_attach() was called; not tracked */
+  guint64 attached;
+
+  /* Whether to record the creation stack of new objects of this type */
+  gboolean capture_stacks;
+  /* Whether objects of this type left alive at exit are leaks */
+  gboolean leak_checked;
+
+  /* Objects created before arming, which are not tracked, nor adopted
+   * later as they cannot be told apart from objects created while off */
+  guint64 unarmed;
+  /* Whether the first object of this type arms tracking */
+  gboolean arm_trigger;
+
+  /* Thresholds of the GOBJECT_LIST_TRIGGERS on this type, or 0 */
+  guint64 live_trigger;
+  guint refcount_trigger;
+  /* Monotonic time until which objects of this type are traced, or 0 if
+   * never triggered */
+  gint64 trace_until;
+
+  SuppressMode suppress;
+  /* stack ID -> 1 if suppressed, 2 otherwise; NULL until needed */
+  GHashTable *suppressed_stacks;  /* owned */
+  struct _LeakHistory *leak;  /* owned; NULL unless leak detection is on */
+} TypeStats;
+
+/* Information about a single tracked object. */
+typedef struct
+{
+  gpointer obj;  /* unowned */
+  TypeStats *type;  /* unowned */
+  guint64 serial;
+  gsize size;  /* bytes accounted to @type when the object was created */
+  /* Slot in the shared memory object table, -1 if not published, or
+   * SHM_SLOT_OVERFLOW if counted in overflow_objects for lack of a slot */
+  gint shm_slot;
+  guint stack_id;  /* interned creation stack, or 0 if not recorded */
+  guint weight;  /* number of objects this one stands for when sampling */
+  gboolean unknown_origin;  /* created while tracking was switched off */
+  gint64 trace_until;  /* monotonic time until which refs are traced, or 0 */
+  gint64 time;  /* monotonic time at which tracking started */
+} ObjectInfo;
+
+#define SHM_SLOT_OVERFLOW (-2)
+
+#define MAX_STACK_DEPTH 32
+
+/* An interned stack trace. Stack traces are never freed, so pointers to them
+ * remain valid without the @gobject_list lock held. */
+typedef struct
+{
+  guint id;
+  guint hash;
+  guint n_frames;
+  gpointer frames[];
+} StackTrace;
+
+/* A frame of a suppression: a function or object pattern, or ‘...’ which
+ * matches any number of frames. */
+typedef enum
+{
+  SUPPRESSION_FRAME_FUN,
+  SUPPRESSION_FRAME_OBJ,
+  SUPPRESSION_FRAME_ANY,
+} SuppressionFrameKind;
+
+typedef struct
+{
+  SuppressionFrameKind kind;
+  GPatternSpec *pattern;  /* owned; NULL for SUPPRESSION_FRAME_ANY */
+} SuppressionFrame;
+
+/* A suppression from GOBJECT_LIST_SUPPRESSIONS: objects of a matching type
+ * created from a matching stack are expected to stay alive, and not
+ * tracked. */
+typedef struct
+{
+  gchar *name;  /* owned */
+  GPatternSpec *type;  /* owned; NULL to match every type */
+  GArray *frames;  /* owned; (SuppressionFrame) from the top of the stack */
+} Suppression;
+
 typedef struct {
+  /* GObject -> (ObjectInfo *) */
   GHashTable *objects;  /* owned */
+  /* GType -> (TypeStats *) */
+  GHashTable *types;  /* owned */
+  guint64 next_serial;
+  /* (StackTrace *) -> (StackTrace *), for interning */
+  GHashTable *stacks;  /* owned */
+  /* stack ID - 1 -> (StackTrace *) */
+  GPtrArray *stacks_by_id;  /* owned */
 
   /* Those 2 hash tables contains the objects which have been added/removed
    * since the last time we catched the USR2 signal (check point). */
@@ -87,6 +218,314 @@ G_LOCK_DEFINE_STATIC (gobject_list);
  * read */
 static GMutex output_mutex;
 
+/* Only one in @sample_rate objects is tracked when sampling. Which ones is
+ * decided by hashing a creation counter, so the decision is deterministic
+ * and independent of address reuse by allocators. */
+static volatile guint sample_rate = 1;
+static volatile gint creation_counter = 0;
+
+/* Hooks whose own cost is measured, excluding the time spent in the wrapped
+ * function. */
+typedef enum
+{
+  HOOK_OBJECT_NEW,
+  HOOK_OBJECT_REF,
+  HOOK_OBJECT_UNREF,
+  HOOK_FINALIZE,
+  HOOK_MINI_OBJECT_NEW,
+  HOOK_MINI_OBJECT_REF,
+  HOOK_MINI_OBJECT_UNREF,
+  N_HOOKS,
+} HookId;
+
+static const gchar *hook_names[N_HOOKS] =
+{
+  "g_object_new",
+  "g_object_ref",
+  "g_object_unref",
+  "finalize",
+  "mini_object_new",
+  "gst_mini_object_ref",
+  "gst_mini_object_unref",
+};
+
+typedef struct
+{
+  gint64 start;  /* ns, or 0 if timing is off */
+  gint64 real_start;
+} HookTimer;
+
+/* Whether hooks measure their own cost; only set during initialisation */
+static gboolean hook_timing = FALSE;
+/* Total time spent in each hook, in ns, updated atomically */
+static guint64 hook_time[N_HOOKS];
+
+/* Latency histogram with power-of-two buckets: bucket i counts durations
+ * of less than 2^i ns. All fields are updated atomically. */
+#define HISTOGRAM_BUCKETS 40
+
+typedef struct
+{
+  guint64 count;
+  guint64 max;
+  guint64 buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+typedef enum
+{
+  LOCK_GOBJECT_LIST,
+  LOCK_OUTPUT,
+  N_LOCKS,
+} LockId;
+
+static const gchar *lock_names[N_LOCKS] =
+{
+  "gobject_list",
+  "output_mutex",
+};
+
+/* Whether to keep the histograms below, printed on exit and on SIGUSR1;
+ * only set during initialisation */
+static gboolean self_stats = FALSE;
+static Histogram hook_histograms[N_HOOKS];
+/* Wait times of contended acquisitions of each lock */
+static Histogram lock_histograms[N_LOCKS];
+static guint64 lock_acquisitions[N_LOCKS];
+
+/* Settings which the overhead budget controller may adjust at runtime */
+static volatile guint backtrace_depth = MAX_STACK_DEPTH;
+static volatile gboolean record_refs = TRUE;
+
+/* Overhead budget, as a fraction of the process’ CPU time, or 0 if there is
+ * no budget. */
+static gdouble overhead_budget = 0;
+/* Sampling rate configured with GOBJECT_LIST_SAMPLE, which the controller
+ * never goes below */
+static guint base_sample_rate = 1;
+
+#define BUDGET_INTERVAL G_TIME_SPAN_SECOND
+/* Number of consecutive intervals well under budget before relaxing */
+#define BUDGET_RELAX_INTERVALS 5
+#define BUDGET_MIN_BACKTRACE_DEPTH 4
+#define BUDGET_MAX_SAMPLE_RATE 65536
+
+/* Shared memory segment publishing the per-type counters and, optionally, the
+ * live object table. Only written with the @gobject_list lock held. */
+static GObjectListShmHeader *shm_header = NULL;
+static gsize shm_size = 0;
+static gchar *shm_name = NULL;  /* owned */
+/* Stack of free slots in the object table; (guint32) slot indices */
+static GArray *shm_free_slots = NULL;  /* owned */
+
+/* A periodic task run by the worker thread. Tasks are only added before the
+ * thread is started, so the table itself needs no locking. */
+typedef struct
+{
+  gint64 interval;  /* µs */
+  gint64 next;  /* monotonic time of the next run */
+  void (*func) (gint64 now);
+} WorkerTask;
+
+#define MAX_WORKER_TASKS 8
+
+#define ADOPT_WINDOW (10 * G_TIME_SPAN_SECOND)
+#define TOGGLE_POLL_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+#define ARM_POLL_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+static WorkerTask worker_tasks[MAX_WORKER_TASKS];
+static guint n_worker_tasks = 0;
+static GThread *worker_thread = NULL;
+/* Protects @worker_quit and is used with @worker_cond to wake the thread */
+static GMutex worker_mutex;
+static GCond worker_cond;
+static gboolean worker_quit = FALSE;
+
+/* Time series output, written by the worker thread only */
+static FILE *timeseries_file = NULL;
+
+/* Live counts of a type at the end of the most recent leak detection
+ * windows. */
+typedef struct _LeakHistory
+{
+  guint64 *samples;  /* ring buffer of leak_detect_windows + 1 entries */
+  guint n_samples;
+  guint next;
+  guint64 alert_level;  /* live count at the last alert, or 0 */
+} LeakHistory;
+
+/* Leak detection settings; leak detection is off if the interval is 0 */
+static gint64 leak_detect_interval = 0;  /* µs */
+static guint leak_detect_windows = 6;
+static guint64 leak_detect_min_growth = 100;
+
+#define LEAK_DETECT_TOP_STACKS 3
+
+/* Names of the types checked for leaks at exit, along with their subtypes;
+ * NULL if the leak check is off, and empty to check every type. */
+static gchar **leak_check_types = NULL;  /* owned */
+static gint leak_check_exit_code = 1;
+
+#define OBJECT_GROUP_TOP_STACKS 5
+
+/* Whether objects are tracked individually yet; before that, creations are
+ * only counted per type. Arming happens once, on one of the triggers in
+ * GOBJECT_LIST_ARM or on gobject_list_arm(). */
+static volatile gboolean armed = TRUE;
+/* Monotonic time at which to arm, or 0; names of the types whose first
+ * object arms, or NULL. Only set before any object is created. */
+static gint64 arm_time = 0;
+static gchar **arm_types = NULL;  /* owned */
+/* Objects created before arming. Protected by the gobject_list lock. */
+static guint64 unarmed_objects = 0;
+/* Set by the SIGRTMIN+1 handler, and handled by the worker thread */
+static volatile gint arm_requested = FALSE;
+
+/* How lists of objects are printed, from GOBJECT_LIST_DUMP */
+typedef enum
+{
+  DUMP_LIST,  /* one line per object */
+  DUMP_RETENTION,  /* only the objects nothing else retains */
+  DUMP_DOMINATORS,  /* as DUMP_RETENTION, over the deep scan references */
+  DUMP_SITES,  /* grouped by type and creation stack */
+} DumpMode;
+
+static DumpMode dump_mode = DUMP_LIST;
+/* Whether DUMP_SITES sorts by bytes rather than by number of objects */
+static gboolean dump_sites_by_bytes = FALSE;
+
+/* Object properties referencing other tracked objects, found by the deep
+ * scan of GOBJECT_LIST_DUMP=dominators */
+typedef struct
+{
+  guint64 serial;  /* of the referencing object */
+  guint pass;  /* deep scan pass which found them */
+  GArray *targets;  /* (guint64) serials of the referenced objects; owned */
+} ScanEdges;
+
+/* An object queued for the deep scan */
+typedef struct
+{
+  gpointer obj;
+  guint64 serial;
+} ScanEntry;
+
+/* Time spent scanning per slice, interval between slices, and how long a
+ * slice may wait for the default main context before the scan is reported
+ * as stalled */
+#define DEEP_SCAN_BUDGET (5 * G_TIME_SPAN_MILLISECOND)
+#define DEEP_SCAN_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+#define DEEP_SCAN_STALL (5 * G_TIME_SPAN_SECOND)
+
+/* (guint64 *) serial -> (ScanEdges *), for objects referencing any. Protected
+ * by the gobject_list lock, as are the counters below. */
+static GHashTable *scan_edges = NULL;  /* owned */
+static guint scan_pass = 0;
+static guint scan_passes_done = 0;
+/* Objects in the current pass, and scanned so far in it */
+static guint scan_pass_size = 0;
+static guint scan_pass_scanned = 0;
+/* GObjects tracked since the current pass started, which join the next one */
+static GArray *scan_added = NULL;  /* owned; ScanEntry */
+/* Monotonic time at which the pending slice was scheduled, or 0 if none is;
+ * whether the scan stalled, in which case @scan_added is not kept and the
+ * next pass is made of the whole registry */
+static gint64 scan_slice_scheduled = 0;
+static gboolean scan_stalled = FALSE;
+/* Objects left to scan in the current pass, those of it still alive, and
+ * per-type lists of object properties; only used by the slices, which all
+ * run in the default main context. */
+static GArray *scan_queue = NULL;  /* owned; ScanEntry */
+static guint scan_queue_next = 0;
+static GArray *scan_survivors = NULL;  /* owned; ScanEntry */
+/* GType -> (GPtrArray *) of GParamSpec */
+static GHashTable *scan_pspecs = NULL;  /* owned */
+
+/* A condition from GOBJECT_LIST_TRIGGERS which switches on detailed tracing:
+ * creation stacks and a backtrace for each ref and unref. */
+typedef enum
+{
+  TRIGGER_LIVE,  /* live count of a type above a threshold */
+  TRIGGER_REFCOUNT,  /* ref count of an object of a type above a threshold */
+  TRIGGER_SERIAL,  /* object with a given serial reffed or unreffed */
+} TriggerKind;
+
+typedef struct
+{
+  TriggerKind kind;
+  gchar *type_name;  /* owned; NULL for TRIGGER_SERIAL */
+  guint64 value;
+  gboolean fired;  /* only set for TRIGGER_SERIAL, which fire once */
+} Trigger;
+
+/* (Trigger); NULL if GOBJECT_LIST_TRIGGERS is unset */
+static GArray *triggers = NULL;  /* owned */
+static gint64 trigger_duration = 10 * G_TIME_SPAN_SECOND;
+/* Whether the ref and unref hooks have to look the object up, because a
+ * trigger depends on refs or tracing was triggered. Cleared by trace_ref()
+ * once neither is the case anymore. */
+static volatile gboolean trace_refs = FALSE;
+/* Ref and serial triggers which may still fire, and the monotonic time until
+ * which some object or type is traced. Protected by the gobject_list lock. */
+static guint ref_triggers_pending = 0;
+static gint64 trace_refs_until = 0;
+
+/* Progress of a top-level bin through a NULL→PLAYING→NULL cycle, for
+ * GOBJECT_LIST_STATE_CHECKPOINTS. The checkpoints are unsaved ones, freed at
+ * the end of each cycle. */
+typedef struct
+{
+  guint cycle;
+  gboolean is_playing;
+  /* owned; first PAUSED→PLAYING, or NULL */
+  GObjectListCheckpoint *playing;
+  /* owned; last PLAYING→PAUSED, or NULL */
+  GObjectListCheckpoint *paused;
+} PipelineCycle;
+
+/* (GstElement *) -> (PipelineCycle *), dropped when the bin is disposed;
+ * NULL unless GOBJECT_LIST_STATE_CHECKPOINTS is set. Protected by the
+ * gobject_list lock. */
+static GHashTable *pipeline_cycles = NULL;  /* owned */
+/* Whether to record the creation stack of every object while a top-level bin
+ * is PLAYING, and how many are. Protected by the gobject_list lock. */
+static gboolean pipeline_cycle_stacks = FALSE;
+static guint pipelines_playing = 0;
+
+/* (Suppression *), from GOBJECT_LIST_SUPPRESSIONS; NULL if unset. Only
+ * modified before any object is tracked. */
+static GPtrArray *suppressions = NULL;  /* owned */
+/* Number of objects not tracked because of a suppression. Protected by the
+ * gobject_list lock. */
+static guint64 suppressed_objects = 0;
+
+/* Set by gobject_list_attach(): number of objects alive at that point, which
+ * are counted per type but not tracked. Protected by the gobject_list lock. */
+static guint64 attached_objects = 0;
+/* Whether the one-time setup runs from gobject_list_attach(), in a process
+ * whose signal handlers and environment are not ours to change */
+static gboolean attaching = FALSE;
+/* Whether the hooks track anything; while FALSE they only call the real
+ * functions. See tracking_set_enabled(). */
+static volatile gboolean tracking_enabled = TRUE;
+/* Set once tracking has been off, after which untracked objects seen by the
+ * hooks may have been created in the meantime. Cleared by adopt_object() once
+ * @adopt_until, ADOPT_WINDOW after switching back on, has passed, so that
+ * refs and unrefs of untracked objects do not keep taking the lock. */
+static volatile gboolean adopt_untracked = FALSE;
+static gint64 adopt_until = 0;  /* protected by the gobject_list lock */
+/* Set by the SIGRTMIN handler, and handled by the worker thread */
+static volatile gint toggle_requested = FALSE;
+
+/* Hooks installed on top of LD_PRELOAD, from GOBJECT_LIST_HOOK or
+ * gobject_list_attach() */
+typedef enum
+{
+  HOOK_MODE_GOT = 1,
+  HOOK_MODE_TRAMPOLINE = 1 << 1,
+} HookModes;
+
+static HookModes hook_modes = 0;
+
 
 static gboolean
 display_filter (DisplayFlags flags)
@@ -136,208 +575,4036 @@ object_filter (const char *obj_name)
 {
   const char *filter = g_getenv ("GOBJECT_LIST_FILTER");
 
-	  return FALSE;
   if (filter == NULL)
     return TRUE;
   else
     return (strncmp (filter, obj_name, strlen (filter)) == 0);
 }
 
-static void
-print_trace (void)
+static gint64
+get_time_ns (clockid_t clock)
 {
-#ifdef HAVE_LIBUNWIND
-  unw_context_t uc;
-  unw_cursor_t cursor;
-  guint stack_num = 0;
+  struct timespec ts;
 
-  if (!display_filter (DISPLAY_FLAG_BACKTRACE))
-    return;
+  clock_gettime (clock, &ts);
 
-  unw_getcontext (&uc);
-  unw_init_local (&cursor, &uc);
+  return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-  while (unw_step (&cursor) > 0)
-    {
-      gchar name[129];
-      unw_word_t off;
-      int result;
+static inline void
+hook_timer_start (HookTimer *timer)
+{
+  timer->start = hook_timing ? get_time_ns (CLOCK_MONOTONIC) : 0;
+}
 
-      result = unw_get_proc_name (&cursor, name, sizeof (name), &off);
-      if (result < 0 && result != -UNW_ENOMEM)
-        {
-          g_print ("Error getting frame: %s (%d)\n",
-                   unw_strerror (result), -result);
-          break;
-        }
+/* Bracket the call to the wrapped function, so that its duration is not
+ * accounted to the hook. */
+static inline void
+hook_timer_real_begin (HookTimer *timer)
+{
+  if (timer->start != 0)
+    timer->real_start = get_time_ns (CLOCK_MONOTONIC);
+}
 
-      g_print ("#%d  %s + [0x%08x]\n", stack_num++, name, (unsigned int)off);
-    }
-#endif
+static inline void
+hook_timer_real_end (HookTimer *timer)
+{
+  if (timer->start != 0)
+    timer->start += get_time_ns (CLOCK_MONOTONIC) - timer->real_start;
 }
 
 static void
-_dump_object_list (GHashTable *hash)
+histogram_add (Histogram *histogram,
+    guint64 value)
 {
-  GHashTableIter iter;
-  GObject *obj;
+  guint bucket = (value == 0) ? 0 : 64 - __builtin_clzll (value);
+  guint64 max = __atomic_load_n (&histogram->max, __ATOMIC_RELAXED);
 
-  g_hash_table_iter_init (&iter, hash);
-  while (g_hash_table_iter_next (&iter, (gpointer) &obj, NULL))
-    {
-      /* FIXME: Not really sure how we get to this state. */
-      if (obj == NULL || obj->ref_count == 0)
-        continue;
+  bucket = MIN (bucket, HISTOGRAM_BUCKETS - 1);
 
-      GST_ERROR (" - %" GST_PTR_FORMAT " (%p) : %u refs", obj, obj,
-              obj->ref_count);
-    }
-  g_print ("%u objects\n", g_hash_table_size (hash));
+  __atomic_fetch_add (&histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+  while (value > max &&
+         !__atomic_compare_exchange_n (&histogram->max, &max, value, TRUE,
+             __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 }
 
-static void
-_sig_usr1_handler (G_GNUC_UNUSED int signal)
+/* Upper bound of the bucket containing the @percentile-th percentile. */
+static guint64
+histogram_percentile (const Histogram *histogram,
+    gdouble percentile)
 {
-  g_print ("Living Objects:\n");
+  guint64 target = histogram->count * percentile / 100;
+  guint64 seen = 0;
+  guint i;
 
-  G_LOCK (gobject_list);
-  _dump_object_list (gobject_list_state.objects);
-  G_UNLOCK (gobject_list);
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      seen += histogram->buckets[i];
+      if (seen > target)
+        return MIN (G_GUINT64_CONSTANT (1) << i, histogram->max);
+    }
+
+  return histogram->max;
 }
 
-static void
-_sig_usr2_handler (G_GNUC_UNUSED int signal)
+static inline void
+hook_timer_stop (HookTimer *timer,
+    HookId hook)
 {
-  GHashTableIter iter;
-  gpointer obj, type;
+  gint64 elapsed;
 
-  G_LOCK (gobject_list);
+  if (timer->start == 0)
+    return;
 
-  g_print ("Added Objects:\n");
-  _dump_object_list (gobject_list_state.added);
+  elapsed = get_time_ns (CLOCK_MONOTONIC) - timer->start;
+  __atomic_fetch_add (&hook_time[hook], elapsed, __ATOMIC_RELAXED);
 
-  g_print ("\nRemoved Objects:\n");
-  g_hash_table_iter_init (&iter, gobject_list_state.removed);
-  while (g_hash_table_iter_next (&iter, &obj, &type))
+  if (self_stats)
+    histogram_add (&hook_histograms[hook], elapsed);
+}
+
+static void
+lock_mutex (GMutex *mutex,
+    LockId lock)
+{
+  gint64 start;
+
+  if (!self_stats)
     {
-      GST_ERROR (" - %" GST_PTR_FORMAT "(%p)", obj, obj);
+      g_mutex_lock (mutex);
+      return;
     }
-  g_print ("%u objects\n", g_hash_table_size (gobject_list_state.removed));
 
-  g_hash_table_remove_all (gobject_list_state.added);
-  g_hash_table_remove_all (gobject_list_state.removed);
-  g_print ("\nSaved new check point\n");
+  __atomic_fetch_add (&lock_acquisitions[lock], 1, __ATOMIC_RELAXED);
 
-  G_UNLOCK (gobject_list);
+  if (g_mutex_trylock (mutex))
+    return;
+
+  start = get_time_ns (CLOCK_MONOTONIC);
+  g_mutex_lock (mutex);
+  histogram_add (&lock_histograms[lock],
+      get_time_ns (CLOCK_MONOTONIC) - start);
 }
 
-static void
-print_still_alive (void)
+/* Whether the current thread holds the gobject_list lock. Printing objects
+ * with it held may ref and unref them, e.g. GST_PTR_FORMAT refs the parents
+ * of a GstObject, so the hooks taking the lock, adopt_object() and
+ * trace_ref(), must not try to take it again then. */
+static __thread gboolean gobject_list_locked = FALSE;
+
+/* Take the lock protecting @gobject_list_state, recording the time spent
+ * waiting for it if GOBJECT_LIST_SELF_STATS is set. */
+static inline void
+gobject_list_lock (void)
 {
-  g_print ("\nStill Alive in %s:\n", g_get_prgname());
+  lock_mutex (&G_LOCK_NAME (gobject_list), LOCK_GOBJECT_LIST);
+  gobject_list_locked = TRUE;
+}
 
-  G_LOCK (gobject_list);
-  _dump_object_list (gobject_list_state.objects);
+static inline void
+gobject_list_unlock (void)
+{
+  gobject_list_locked = FALSE;
   G_UNLOCK (gobject_list);
 }
 
-static void
-_exiting (void)
+static inline void
+output_lock (void)
 {
-  print_still_alive ();
+  lock_mutex (&output_mutex, LOCK_OUTPUT);
 }
 
-/* Handle signals which terminate the process. We’re technically not allowed to
- * call printf() from this signal handler, but we do anyway as it’s only a
- * best-effort debugging tool. */
-static void
-_sig_bad_handler (int sig_num)
+static inline void
+output_unlock (void)
 {
-  signal (sig_num, SIG_DFL);
-  print_still_alive ();
-  raise (sig_num);
+  g_mutex_unlock (&output_mutex);
 }
 
-static void *
-get_func (const char *func_name)
+static void
+print_self_stats (void)
 {
-  static void *handle = NULL;
-  void *func;
-  char *error;
+  guint i;
 
-  G_LOCK (gobject_list);
+  if (!self_stats)
+    return;
 
-  if (G_UNLIKELY (g_once_init_enter (&handle)))
-    {
-      void *_handle;
+  g_print ("\ngobject-list self statistics (time spent in hooks, excluding "
+      "the wrapped functions):\n");
+  g_print ("%-24s %12s %10s %10s %10s %12s %12s\n", "hook", "calls",
+      "mean ns", "p50 ns", "p99 ns", "max ns", "total ms");
 
-      _handle = dlopen("libgobject-2.0.so.0", RTLD_LAZY);
+  for (i = 0; i < N_HOOKS; i++)
+    {
+      const Histogram *histogram = &hook_histograms[i];
 
-      if (_handle == NULL)
-        g_error ("Failed to open libgobject-2.0.so.0: %s", dlerror ());
+      if (histogram->count == 0)
+        continue;
 
-      /* set up signal handlers */
-      signal (SIGUSR1, _sig_usr1_handler);
-      signal (SIGUSR2, _sig_usr2_handler);
-      signal (SIGINT, _sig_bad_handler);
-      signal (SIGTERM, _sig_bad_handler);
-      signal (SIGABRT, _sig_bad_handler);
-      signal (SIGSEGV, _sig_bad_handler);
+      g_print ("%-24s %12" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+          " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %12"
+          G_GUINT64_FORMAT " %12.1f\n", hook_names[i], histogram->count,
+          hook_time[i] / histogram->count,
+          histogram_percentile (histogram, 50),
+          histogram_percentile (histogram, 99), histogram->max,
+          hook_time[i] / 1e6);
+    }
 
-      /* set up objects map */
-      gobject_list_state.objects = g_hash_table_new (NULL, NULL);
-      gobject_list_state.added = g_hash_table_new (NULL, NULL);
-      gobject_list_state.removed = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  g_print ("\n%-24s %12s %10s %10s %10s %12s %12s\n", "lock",
+      "acquisitions", "contended", "p50 ns", "p99 ns", "max ns", "wait ms");
 
-      /* Set up exit handler */
-      atexit (_exiting);
+  for (i = 0; i < N_LOCKS; i++)
+    {
+      const Histogram *histogram = &lock_histograms[i];
+      guint64 total = 0;
+      guint j;
 
-      /* Prevent propagation to child processes. */
-      if (g_getenv ("GOBJECT_PROPAGATE_LD_PRELOAD") == NULL)
-        {
-          g_unsetenv ("LD_PRELOAD");
-        }
+      /* Approximate the total wait from the bucket midpoints. */
+      for (j = 1; j < HISTOGRAM_BUCKETS; j++)
+        total += histogram->buckets[j] *
+            (3 * (G_GUINT64_CONSTANT (1) << j) / 4);
 
-      g_once_init_leave (&handle, _handle);
+      g_print ("%-24s %12" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+          " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %12"
+          G_GUINT64_FORMAT " %12.1f\n", lock_names[i], lock_acquisitions[i],
+          histogram->count, histogram_percentile (histogram, 50),
+          histogram_percentile (histogram, 99), histogram->max, total / 1e6);
     }
+}
 
-  func = dlsym (handle, func_name);
-
-  if ((error = dlerror ()) != NULL)
-    g_error ("Failed to find symbol: %s", error);
-
-  G_UNLOCK (gobject_list);
+static void
+self_stats_setup (void)
+{
+  if (g_getenv ("GOBJECT_LIST_SELF_STATS") == NULL)
+    return;
 
-  return func;
+  self_stats = TRUE;
+  hook_timing = TRUE;
 }
 
 static void
-_object_finalized (G_GNUC_UNUSED gpointer data,
-    gpointer obj)
+print_trace (void)
 {
-  G_LOCK (gobject_list);
+#ifdef HAVE_LIBUNWIND
+  unw_context_t uc;
+  unw_cursor_t cursor;
+  guint stack_num = 0;
 
-  if (display_filter (DISPLAY_FLAG_CREATE))
-    {
-      g_mutex_lock(&output_mutex);
+  if (!display_filter (DISPLAY_FLAG_BACKTRACE))
+    return;
 
+  unw_getcontext (&uc);
+  unw_init_local (&cursor, &uc);
 
-      GST_ERROR (" -- Finalized %" GST_PTR_FORMAT "(%p)", obj, obj);
-      print_trace();
+  while (stack_num < backtrace_depth && unw_step (&cursor) > 0)
+    {
+      gchar name[129];
+      unw_word_t off;
+      int result;
 
-      g_mutex_unlock(&output_mutex);
+      result = unw_get_proc_name (&cursor, name, sizeof (name), &off);
+      if (result < 0 && result != -UNW_ENOMEM)
+        {
+          g_print ("Error getting frame: %s (%d)\n",
+                   unw_strerror (result), -result);
+          break;
+        }
 
-      /* Only care about the object which were already existing during last
-       * check point. */
-      if (g_hash_table_lookup (gobject_list_state.added, obj) == NULL)
-        g_hash_table_insert (gobject_list_state.removed, obj,
-            g_strdup (G_OBJECT_TYPE_NAME (obj)));
+      g_print ("#%d  %s + [0x%08x]\n", stack_num++, name, (unsigned int)off);
     }
+#endif
+}
+
+/* Decide whether to track a newly created object. Returns the weight of the
+ * object if it is to be tracked, or 0 otherwise. This is called without the
+ * gobject_list lock held, so that untracked objects cost no locking. */
+static guint
+sample_creation (void)
+{
+  guint rate = sample_rate;
+  guint64 hash;
+
+  if (rate <= 1)
+    return 1;
+
+  hash = (guint) g_atomic_int_add (&creation_counter, 1);
+  hash *= G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+  hash ^= hash >> 32;
+
+  return (hash % rate == 0) ? rate : 0;
+}
+
+static void
+sampling_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_SAMPLE");
+
+  if (env != NULL)
+    sample_rate = CLAMP (g_ascii_strtoull (env, NULL, 10), 1, G_MAXUINT32);
+
+  base_sample_rate = sample_rate;
+}
+
+static guint
+stack_trace_hash (gconstpointer key)
+{
+  const StackTrace *stack = key;
+
+  return stack->hash;
+}
+
+static gboolean
+stack_trace_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const StackTrace *sa = a, *sb = b;
+
+  return sa->n_frames == sb->n_frames &&
+      memcmp (sa->frames, sb->frames, sa->n_frames * sizeof (gpointer)) == 0;
+}
+
+/* Capture the current stack and return its interned ID. Must be called with
+ * the gobject_list lock held. */
+static guint
+capture_stack (void)
+{
+  gpointer frames[MAX_STACK_DEPTH];
+  StackTrace *stack;
+  gint n_frames;
+  guint hash = 5381;
+  gint i;
+
+#ifdef HAVE_LIBUNWIND
+  n_frames = unw_backtrace (frames, MIN (backtrace_depth, MAX_STACK_DEPTH));
+#else
+  n_frames = backtrace (frames, MIN (backtrace_depth, MAX_STACK_DEPTH));
+#endif
+
+  if (n_frames <= 0)
+    return 0;
+
+  for (i = 0; i < n_frames; i++)
+    hash = hash * 33 + GPOINTER_TO_SIZE (frames[i]);
+
+  stack = g_malloc (sizeof (StackTrace) + n_frames * sizeof (gpointer));
+  stack->hash = hash;
+  stack->n_frames = n_frames;
+  memcpy (stack->frames, frames, n_frames * sizeof (gpointer));
+
+  {
+    StackTrace *interned;
+
+    interned = g_hash_table_lookup (gobject_list_state.stacks, stack);
+    if (interned != NULL)
+      {
+        g_free (stack);
+        return interned->id;
+      }
+  }
+
+  g_ptr_array_add (gobject_list_state.stacks_by_id, stack);
+  stack->id = gobject_list_state.stacks_by_id->len;
+  g_hash_table_insert (gobject_list_state.stacks, stack, stack);
+
+  return stack->id;
+}
+
+/* Must be called with the gobject_list lock held. */
+static StackTrace *
+get_stack (guint stack_id)
+{
+  if (stack_id == 0 || stack_id > gobject_list_state.stacks_by_id->len)
+    return NULL;
+
+  return g_ptr_array_index (gobject_list_state.stacks_by_id, stack_id - 1);
+}
+
+/* Resolve the frames of @stack into @infos, which must have room for
+ * MAX_STACK_DEPTH entries. Returns the index of the first frame outside
+ * gobject-list itself. */
+static guint
+resolve_stack (const StackTrace *stack,
+    Dl_info *infos)
+{
+  Dl_info self_info;
+  guint i, first = stack->n_frames;
+
+  if (!dladdr ((gpointer) resolve_stack, &self_info))
+    self_info.dli_fbase = NULL;
+
+  for (i = 0; i < stack->n_frames; i++)
+    {
+      Dl_info *info = &infos[i];
+
+      if (!dladdr (stack->frames[i], info))
+        {
+          info->dli_fname = NULL;
+          info->dli_fbase = NULL;
+          info->dli_sname = NULL;
+          info->dli_saddr = NULL;
+        }
+
+      if (first == stack->n_frames &&
+          (info->dli_fbase == NULL || info->dli_fbase != self_info.dli_fbase))
+        first = i;
+    }
+
+  return first;
+}
+
+/* Print a captured stack, skipping the frames inside gobject-list itself. */
+static void
+print_stack (const StackTrace *stack)
+{
+  Dl_info infos[MAX_STACK_DEPTH];
+  guint i, n = 0;
+
+  for (i = resolve_stack (stack, infos); i < stack->n_frames; i++)
+    {
+      const Dl_info *info = &infos[i];
+
+      if (info->dli_sname != NULL)
+        g_print ("#%u  %s + [0x%08x]\n", n++, info->dli_sname,
+            (unsigned int) ((gchar *) stack->frames[i] -
+                (gchar *) info->dli_saddr));
+      else if (info->dli_fname != NULL)
+        g_print ("#%u  %p (%s)\n", n++, stack->frames[i], info->dli_fname);
+      else
+        g_print ("#%u  %p\n", n++, stack->frames[i]);
+    }
+}
+
+static gboolean
+pattern_match (GPatternSpec *pattern,
+    const gchar *string)
+{
+#if GLIB_CHECK_VERSION (2, 70, 0)
+  return g_pattern_spec_match_string (pattern, string);
+#else
+  return g_pattern_match_string (pattern, string);
+#endif
+}
+
+/* Whether @frames match the leading frames of a stack, as resolved by
+ * resolve_stack(). */
+static gboolean
+suppression_match_frames (const SuppressionFrame *frames,
+    guint n_frames,
+    const Dl_info *infos,
+    guint n_infos)
+{
+  const gchar *name;
+  guint i;
+
+  if (n_frames == 0)
+    return TRUE;
+
+  if (frames[0].kind == SUPPRESSION_FRAME_ANY)
+    {
+      for (i = 0; i <= n_infos; i++)
+        {
+          if (suppression_match_frames (frames + 1, n_frames - 1, infos + i,
+                  n_infos - i))
+            return TRUE;
+        }
+
+      return FALSE;
+    }
+
+  if (n_infos == 0)
+    return FALSE;
+
+  if (frames[0].kind == SUPPRESSION_FRAME_FUN)
+    name = infos[0].dli_sname;
+  else
+    name = infos[0].dli_fname;
+
+  if (name == NULL || !pattern_match (frames[0].pattern, name))
+    return FALSE;
+
+  return suppression_match_frames (frames + 1, n_frames - 1, infos + 1,
+      n_infos - 1);
+}
+
+/* Whether @suppression applies to @type or one of its ancestors, regardless
+ * of its frames. */
+static gboolean
+suppression_match_type (const Suppression *suppression,
+    GType type)
+{
+  if (suppression->type == NULL)
+    return TRUE;
+
+  for (; type != 0; type = g_type_parent (type))
+    {
+      if (pattern_match (suppression->type, g_type_name (type)))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* How the suppressions apply to new objects of @type, worked out once per
+ * type so that most types cost nothing. */
+static SuppressMode
+suppression_type_mode (GType type)
+{
+  SuppressMode mode = SUPPRESS_NONE;
+  guint i;
+
+  for (i = 0; suppressions != NULL && i < suppressions->len; i++)
+    {
+      const Suppression *suppression = g_ptr_array_index (suppressions, i);
+
+      if (!suppression_match_type (suppression, type))
+        continue;
+
+      if (suppression->frames->len == 0)
+        return SUPPRESS_ALL;
+
+      mode = SUPPRESS_BY_STACK;
+    }
+
+  return mode;
+}
+
+/* Whether an object of @stats created from @stack_id is suppressed. The
+ * answer is cached per stack, as the stacks of a type are few. Must be called
+ * with the gobject_list lock held. */
+static gboolean
+suppression_match_stack (TypeStats *stats,
+    guint stack_id)
+{
+  Dl_info infos[MAX_STACK_DEPTH];
+  const StackTrace *stack;
+  gpointer cached;
+  gboolean suppressed = FALSE;
+  guint i, first;
+
+  if (stats->suppressed_stacks == NULL)
+    stats->suppressed_stacks = g_hash_table_new (NULL, NULL);
+
+  cached = g_hash_table_lookup (stats->suppressed_stacks,
+      GUINT_TO_POINTER (stack_id));
+  if (cached != NULL)
+    return GPOINTER_TO_UINT (cached) == 1;
+
+  stack = get_stack (stack_id);
+  if (stack == NULL)
+    return FALSE;
+
+  first = resolve_stack (stack, infos);
+
+  for (i = 0; !suppressed && i < suppressions->len; i++)
+    {
+      const Suppression *suppression = g_ptr_array_index (suppressions, i);
+
+      suppressed = suppression->frames->len > 0 &&
+          suppression_match_type (suppression, stats->type) &&
+          suppression_match_frames (&g_array_index (suppression->frames,
+                  SuppressionFrame, 0), suppression->frames->len,
+              infos + first, stack->n_frames - first);
+    }
+
+  g_hash_table_insert (stats->suppressed_stacks, GUINT_TO_POINTER (stack_id),
+      GUINT_TO_POINTER (suppressed ? 1 : 2));
+
+  return suppressed;
+}
+
+static void
+suppression_free (Suppression *suppression)
+{
+  guint i;
+
+  for (i = 0; i < suppression->frames->len; i++)
+    {
+      SuppressionFrame *frame = &g_array_index (suppression->frames,
+          SuppressionFrame, i);
+
+      if (frame->pattern != NULL)
+        g_pattern_spec_free (frame->pattern);
+    }
+
+  g_array_unref (suppression->frames);
+  if (suppression->type != NULL)
+    g_pattern_spec_free (suppression->type);
+  g_free (suppression->name);
+  g_free (suppression);
+}
+
+/* Parse a suppression file in a format close to valgrind’s:
+ *
+ *   # comment
+ *   {
+ *      name
+ *      type:GstRegistry
+ *      fun:gst_registry_*
+ *      ...
+ *      obj:*libgstreamer-1.0.so*
+ *   }
+ *
+ * The type line is optional; a suppression without frames suppresses every
+ * object of its type. Invalid suppressions are skipped with a warning. */
+static void
+suppressions_load (const gchar *path)
+{
+  gchar *contents;
+  gchar **lines;
+  Suppression *suppression = NULL;
+  gboolean valid = FALSE;
+  GError *error = NULL;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, &error))
+    {
+      g_warning ("Failed to read suppression file: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  lines = g_strsplit (contents, "\n", 0);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      const gchar *line = g_strstrip (lines[i]);
+      SuppressionFrame frame = { SUPPRESSION_FRAME_ANY, NULL };
+
+      if (*line == '\0' || *line == '#')
+        continue;
+
+      if (suppression == NULL)
+        {
+          if (strcmp (line, "{") != 0)
+            {
+              g_warning ("%s:%u: Expected ‘{’", path, i + 1);
+              continue;
+            }
+
+          suppression = g_new0 (Suppression, 1);
+          suppression->frames = g_array_new (FALSE, FALSE,
+              sizeof (SuppressionFrame));
+          valid = TRUE;
+        }
+      else if (strcmp (line, "}") == 0)
+        {
+          if (valid && suppression->name != NULL)
+            g_ptr_array_add (suppressions, suppression);
+          else
+            suppression_free (suppression);
+
+          suppression = NULL;
+        }
+      else if (suppression->name == NULL)
+        {
+          suppression->name = g_strdup (line);
+        }
+      else if (g_str_has_prefix (line, "type:") &&
+          suppression->type == NULL && suppression->frames->len == 0)
+        {
+          suppression->type = g_pattern_spec_new (line + strlen ("type:"));
+        }
+      else if (g_str_has_prefix (line, "fun:") ||
+          g_str_has_prefix (line, "obj:"))
+        {
+          frame.kind = (line[0] == 'f') ?
+              SUPPRESSION_FRAME_FUN : SUPPRESSION_FRAME_OBJ;
+          frame.pattern = g_pattern_spec_new (line + strlen ("fun:"));
+          g_array_append_val (suppression->frames, frame);
+        }
+      else if (strcmp (line, "...") == 0)
+        {
+          g_array_append_val (suppression->frames, frame);
+        }
+      else
+        {
+          g_warning ("%s:%u: Invalid line in suppression ‘%s’: %s", path,
+              i + 1, suppression->name, line);
+          valid = FALSE;
+        }
+    }
+
+  if (suppression != NULL)
+    {
+      g_warning ("%s: Unterminated suppression ‘%s’", path,
+          suppression->name != NULL ? suppression->name : "");
+      suppression_free (suppression);
+    }
+
+  g_strfreev (lines);
+}
+
+static void
+pipeline_cycles_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_STATE_CHECKPOINTS");
+
+  if (env == NULL)
+    return;
+
+  pipeline_cycles = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  pipeline_cycle_stacks = (g_ascii_strcasecmp (env, "stacks") == 0);
+}
+
+static void
+suppressions_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_SUPPRESSIONS");
+  gchar **paths;
+  guint i;
+
+  if (env == NULL)
+    return;
+
+  suppressions = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) suppression_free);
+
+  paths = g_strsplit (env, G_SEARCHPATH_SEPARATOR_S, 0);
+  for (i = 0; paths[i] != NULL; i++)
+    {
+      if (*paths[i] != '\0')
+        suppressions_load (paths[i]);
+    }
+  g_strfreev (paths);
+}
+
+static void
+shm_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_SHM");
+  const gchar *objects_env = g_getenv ("GOBJECT_LIST_SHM_OBJECTS");
+  guint32 max_objects = 0;
+  gsize types_offset, objects_offset;
+  gpointer mem;
+  gint fd;
+
+  if (env == NULL)
+    return;
+
+  if (objects_env != NULL)
+    max_objects = MIN (g_ascii_strtoull (objects_env, NULL, 10), G_MAXUINT32);
+
+  if (*env == '\0' || g_strcmp0 (env, "1") == 0)
+    shm_name = g_strdup_printf (GOBJECT_LIST_SHM_NAME_FORMAT, getpid ());
+  else if (*env == '/')
+    shm_name = g_strdup (env);
+  else
+    shm_name = g_strdup_printf ("/%s", env);
+
+  types_offset = sizeof (GObjectListShmHeader);
+  objects_offset = types_offset +
+      GOBJECT_LIST_SHM_MAX_TYPES * sizeof (GObjectListShmType);
+  shm_size = objects_offset + max_objects * sizeof (GObjectListShmObject);
+
+  fd = shm_open (shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    {
+      g_warning ("Failed to create shared memory segment %s: %s", shm_name,
+          g_strerror (errno));
+      g_clear_pointer (&shm_name, g_free);
+      return;
+    }
+
+  if (ftruncate (fd, shm_size) < 0 ||
+      (mem = mmap (NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+          fd, 0)) == MAP_FAILED)
+    {
+      g_warning ("Failed to map shared memory segment %s: %s", shm_name,
+          g_strerror (errno));
+      close (fd);
+      shm_unlink (shm_name);
+      g_clear_pointer (&shm_name, g_free);
+      return;
+    }
+
+  close (fd);
+
+  /* The segment is zero-filled by ftruncate(). The magic is written last so
+   * that readers never see a partially initialised header. */
+  shm_header = mem;
+  shm_header->version = GOBJECT_LIST_SHM_VERSION;
+  shm_header->pid = getpid ();
+  shm_header->start_time = g_get_real_time ();
+  shm_header->update_time = shm_header->start_time;
+  shm_header->types_offset = types_offset;
+  shm_header->objects_offset = objects_offset;
+  shm_header->max_objects = max_objects;
+  shm_header->sample_rate = sample_rate;
+  __atomic_store_n (&shm_header->magic, GOBJECT_LIST_SHM_MAGIC,
+      __ATOMIC_RELEASE);
+
+  shm_free_slots = g_array_new (FALSE, FALSE, sizeof (guint32));
+}
+
+/* Remove the segment name on a clean exit. The mapping itself is kept, as
+ * objects may still be finalized by later exit handlers. After a crash the
+ * segment is left behind so that it can be inspected. */
+static void
+shm_teardown (void)
+{
+  if (shm_name == NULL)
+    return;
+
+  shm_unlink (shm_name);
+  g_clear_pointer (&shm_name, g_free);
+}
+
+/* Must be called with the gobject_list lock held. */
+static gint
+shm_add_type (const gchar *name)
+{
+  gint index;
+
+  if (shm_header == NULL)
+    return -1;
+
+  if (shm_header->n_types >= GOBJECT_LIST_SHM_MAX_TYPES)
+    {
+      gobject_list_shm_write_begin (shm_header);
+      shm_header->overflow_types++;
+      gobject_list_shm_write_end (shm_header);
+      return -1;
+    }
+
+  index = shm_header->n_types;
+
+  gobject_list_shm_write_begin (shm_header);
+  g_strlcpy (gobject_list_shm_get_types (shm_header)[index].name, name,
+      GOBJECT_LIST_SHM_TYPE_NAME_LEN);
+  shm_header->n_types++;
+  gobject_list_shm_write_end (shm_header);
+
+  return index;
+}
+
+/* Must be called with the gobject_list lock held, inside a write section. */
+static void
+shm_update_type (TypeStats *stats)
+{
+  GObjectListShmType *entry;
+
+  if (stats->shm_index < 0)
+    return;
+
+  entry = &gobject_list_shm_get_types (shm_header)[stats->shm_index];
+  entry->live = stats->live;
+  entry->created = stats->created;
+  entry->finalized = stats->finalized;
+  entry->live_bytes = stats->live_bytes;
+}
+
+/* Must be called with the gobject_list lock held. */
+static void
+shm_object_added (ObjectInfo *info)
+{
+  if (shm_header == NULL)
+    return;
+
+  gobject_list_shm_write_begin (shm_header);
+
+  shm_update_type (info->type);
+
+  if (shm_header->max_objects > 0 && info->type->shm_index >= 0)
+    {
+      guint32 slot;
+
+      if (shm_free_slots->len > 0)
+        {
+          slot = g_array_index (shm_free_slots, guint32,
+              shm_free_slots->len - 1);
+          g_array_set_size (shm_free_slots, shm_free_slots->len - 1);
+        }
+      else if (shm_header->n_object_slots < shm_header->max_objects)
+        {
+          slot = shm_header->n_object_slots++;
+        }
+      else
+        {
+          slot = G_MAXUINT32;
+          shm_header->overflow_objects++;
+          info->shm_slot = SHM_SLOT_OVERFLOW;
+        }
+
+      if (slot != G_MAXUINT32)
+        {
+          GObjectListShmObject *entry;
+
+          entry = &gobject_list_shm_get_objects (shm_header)[slot];
+          entry->serial = info->serial;
+          entry->type_index = info->type->shm_index;
+          entry->address = GPOINTER_TO_SIZE (info->obj);
+          shm_header->n_objects++;
+          info->shm_slot = slot;
+        }
+    }
+
+  shm_header->update_time = g_get_real_time ();
+  gobject_list_shm_write_end (shm_header);
+}
+
+/* Must be called with the gobject_list lock held. */
+static void
+shm_object_removed (ObjectInfo *info)
+{
+  if (shm_header == NULL)
+    return;
+
+  gobject_list_shm_write_begin (shm_header);
+
+  shm_update_type (info->type);
+
+  if (info->shm_slot >= 0)
+    {
+      guint32 slot = info->shm_slot;
+
+      gobject_list_shm_get_objects (shm_header)[slot].address = 0;
+      shm_header->n_objects--;
+      g_array_append_val (shm_free_slots, slot);
+      info->shm_slot = -1;
+    }
+  else if (info->shm_slot == SHM_SLOT_OVERFLOW)
+    {
+      shm_header->overflow_objects--;
+      info->shm_slot = -1;
+    }
+
+  shm_header->update_time = g_get_real_time ();
+  gobject_list_shm_write_end (shm_header);
+}
+
+/* Whether @type or one of its ancestors is named in @names. By name, as the
+ * types named in environment variables may not be registered yet when they
+ * are parsed. */
+static gboolean
+type_in_list (GType type,
+    gchar **names)
+{
+  guint i;
+
+  for (; type != 0; type = g_type_parent (type))
+    {
+      for (i = 0; names[i] != NULL; i++)
+        {
+          if (strcmp (names[i], g_type_name (type)) == 0)
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* Whether objects of @type are checked for leaks at exit. */
+static gboolean
+leak_check_type (GType type)
+{
+  if (leak_check_types == NULL)
+    return FALSE;
+  if (leak_check_types[0] == NULL)
+    return TRUE;
+
+  return type_in_list (type, leak_check_types);
+}
+
+/* Set the trigger thresholds of the type of @stats. */
+static void
+triggers_apply (TypeStats *stats)
+{
+  guint i;
+
+  for (i = 0; triggers != NULL && i < triggers->len; i++)
+    {
+      const Trigger *trigger = &g_array_index (triggers, Trigger, i);
+      gchar *names[] = { trigger->type_name, NULL };
+
+      if (trigger->type_name == NULL || !type_in_list (stats->type, names))
+        continue;
+
+      if (trigger->kind == TRIGGER_LIVE)
+        stats->live_trigger = trigger->value;
+      else if (trigger->kind == TRIGGER_REFCOUNT)
+        stats->refcount_trigger = trigger->value;
+    }
+}
+
+/* Look objects up in the ref and unref hooks until @until at least. Must be
+ * called with the gobject_list lock held. */
+static void
+trace_refs_extend (gint64 until)
+{
+  trace_refs_until = MAX (trace_refs_until, until);
+  g_atomic_int_set (&trace_refs, TRUE);
+}
+
+/* Must be called with the gobject_list lock held. */
+static TypeStats *
+get_type_stats (GType type)
+{
+  TypeStats *stats;
+
+  stats = g_hash_table_lookup (gobject_list_state.types,
+      GSIZE_TO_POINTER (type));
+  if (stats != NULL)
+    return stats;
+
+  stats = g_new0 (TypeStats, 1);
+  stats->type = type;
+  stats->name = g_type_name (type);
+  stats->shm_index = shm_add_type (stats->name);
+  stats->leak_checked = leak_check_type (type);
+  stats->capture_stacks = stats->leak_checked || dump_mode == DUMP_SITES;
+  stats->suppress = suppression_type_mode (type);
+  stats->arm_trigger = arm_types != NULL && type_in_list (type, arm_types);
+  triggers_apply (stats);
+
+  g_hash_table_insert (gobject_list_state.types, GSIZE_TO_POINTER (type),
+      stats);
+
+  return stats;
+}
+
+/* Start tracking @obj, which must not already be tracked. @size is the number
+ * of bytes accounted to its type while it is alive, and @weight the value
+ * returned by sample_creation(). Returns NULL if the object is suppressed and
+ * not to be tracked. Must be called with the gobject_list lock held. */
+static ObjectInfo *
+register_object (gpointer obj,
+    GType type,
+    gsize size,
+    guint weight)
+{
+  TypeStats *stats = get_type_stats (type);
+  ObjectInfo *info;
+  guint stack_id = 0;
+
+  if (stats->suppress == SUPPRESS_BY_STACK)
+    stack_id = capture_stack ();
+
+  if (stats->suppress == SUPPRESS_ALL ||
+      (stats->suppress == SUPPRESS_BY_STACK &&
+       suppression_match_stack (stats, stack_id)))
+    {
+      suppressed_objects += weight;
+      return NULL;
+    }
+
+  info = g_new0 (ObjectInfo, 1);
+  info->obj = obj;
+  info->type = stats;
+  info->serial = gobject_list_state.next_serial++;
+  info->size = size;
+  info->shm_slot = -1;
+  info->weight = weight;
+  info->time = g_get_monotonic_time ();
+
+  if (info->type->capture_stacks ||
+      (pipeline_cycle_stacks && pipelines_playing > 0) ||
+      (stats->trace_until != 0 &&
+       g_get_monotonic_time () < stats->trace_until))
+    info->stack_id = (stack_id != 0) ? stack_id : capture_stack ();
+
+  info->type->live += weight;
+
+  if (stats->live_trigger != 0 && stats->trace_until == 0 &&
+      stats->live > stats->live_trigger)
+    {
+      stats->trace_until = g_get_monotonic_time () + trigger_duration;
+      trace_refs_extend (stats->trace_until);
+
+      g_print ("gobject-list trigger: %" G_GUINT64_FORMAT " live %s > %"
+          G_GUINT64_FORMAT "; tracing them for %" G_GINT64_FORMAT " s\n",
+          stats->live, stats->name, stats->live_trigger,
+          trigger_duration / G_TIME_SPAN_SECOND);
+    }
+  info->type->created += weight;
+  info->type->live_bytes += (guint64) size * weight;
+
+  g_hash_table_insert (gobject_list_state.objects, obj, info);
+  g_hash_table_insert (gobject_list_state.added, obj, GUINT_TO_POINTER (TRUE));
+
+  if (scan_added != NULL && !scan_stalled &&
+      g_type_is_a (type, G_TYPE_OBJECT))
+    {
+      ScanEntry entry = { obj, info->serial };
+
+      g_array_append_val (scan_added, entry);
+    }
+
+  shm_object_added (info);
+
+  return info;
+}
+
+/* Stop tracking the object described by @info, which is freed. Must be called
+ * with the gobject_list lock held. */
+static void
+unregister_object (ObjectInfo *info)
+{
+  gpointer obj = info->obj;
+
+  info->type->live -= info->weight;
+  info->type->finalized += info->weight;
+  info->type->live_bytes -= (guint64) info->size * info->weight;
+
+  shm_object_removed (info);
+
+  g_hash_table_remove (gobject_list_state.added, obj);
+  g_hash_table_remove (gobject_list_state.objects, obj);
+}
+
+/* Bytes to account to a mini object of @type when it is created. The mini
+ * object has only just been initialised at that point, so this is based on
+ * the type alone; GStreamer allocates larger private structures for most of
+ * them, so this is a lower bound. Buffers get the size of their memory added
+ * once it is known, see update_mini_object_size(). */
+static gsize
+mini_object_size (GType type)
+{
+  if (type == GST_TYPE_BUFFER)
+    return sizeof (GstBuffer);
+  else if (type == GST_TYPE_MEMORY)
+    return sizeof (GstMemory);
+  else if (type == GST_TYPE_CAPS)
+    return sizeof (GstCaps);
+  else if (type == GST_TYPE_EVENT)
+    return sizeof (GstEvent);
+  else if (type == GST_TYPE_QUERY)
+    return sizeof (GstQuery);
+  else if (type == GST_TYPE_MESSAGE)
+    return sizeof (GstMessage);
+  else if (type == GST_TYPE_TAG_LIST)
+    return sizeof (GstTagList);
+
+  return sizeof (GstMiniObject);
+}
+
+/* Change the number of bytes accounted to the tracked @mini_object, if it is
+ * tracked. */
+static void
+update_mini_object_size (GstMiniObject *mini_object,
+    gsize size)
+{
+  ObjectInfo *info;
+
+  gobject_list_lock ();
+
+  info = g_hash_table_lookup (gobject_list_state.objects, mini_object);
+  if (info != NULL && info->size != size)
+    {
+      info->type->live_bytes -= (guint64) info->size * info->weight;
+      info->type->live_bytes += (guint64) size * info->weight;
+      info->size = size;
+
+      if (shm_header != NULL)
+        {
+          gobject_list_shm_write_begin (shm_header);
+          shm_update_type (info->type);
+          gobject_list_shm_write_end (shm_header);
+        }
+    }
+
+  gobject_list_unlock ();
+}
+
+static void
+worker_add_task (gint64 interval,
+    void (*func) (gint64 now))
+{
+  WorkerTask *task;
+
+  g_assert (worker_thread == NULL);
+
+  if (n_worker_tasks >= MAX_WORKER_TASKS)
+    g_error ("Too many worker tasks");
+
+  task = &worker_tasks[n_worker_tasks++];
+  task->interval = interval;
+  task->next = g_get_monotonic_time () + interval;
+  task->func = func;
+}
+
+static gpointer
+worker_thread_func (G_GNUC_UNUSED gpointer data)
+{
+  g_mutex_lock (&worker_mutex);
+
+  while (!worker_quit)
+    {
+      gint64 now = g_get_monotonic_time ();
+      gint64 next = G_MAXINT64;
+      guint i;
+
+      for (i = 0; i < n_worker_tasks; i++)
+        {
+          WorkerTask *task = &worker_tasks[i];
+
+          if (now >= task->next)
+            {
+              g_mutex_unlock (&worker_mutex);
+              task->func (now);
+              g_mutex_lock (&worker_mutex);
+
+              /* Skip missed runs rather than running them back to back. */
+              task->next += task->interval;
+              if (task->next <= now)
+                task->next = now + task->interval;
+            }
+
+          next = MIN (next, task->next);
+        }
+
+      if (!worker_quit)
+        g_cond_wait_until (&worker_cond, &worker_mutex, next);
+    }
+
+  g_mutex_unlock (&worker_mutex);
+
+  return NULL;
+}
+
+static void
+worker_start (void)
+{
+  if (n_worker_tasks == 0)
+    return;
+
+  worker_thread = g_thread_new ("gobject-list", worker_thread_func, NULL);
+}
+
+static void
+worker_stop (void)
+{
+  if (worker_thread == NULL)
+    return;
+
+  g_mutex_lock (&worker_mutex);
+  worker_quit = TRUE;
+  g_cond_signal (&worker_cond);
+  g_mutex_unlock (&worker_mutex);
+
+  g_thread_join (worker_thread);
+  worker_thread = NULL;
+}
+
+/* Snapshot of a type’s counters, taken with the gobject_list lock held so
+ * that it can be written out without it. */
+typedef struct
+{
+  const gchar *name;
+  guint64 live;
+  guint64 created;
+  guint64 finalized;
+  guint64 live_bytes;
+} TypeSample;
+
+/* Append a sample of every type whose counters changed to the time series.
+ * The final sample, with @now set to 0, includes every type. */
+static void
+timeseries_sample (gint64 now)
+{
+  GHashTableIter iter;
+  TypeStats *stats;
+  GArray *samples;
+  gint64 timestamp = g_get_real_time ();
+  guint i;
+
+  samples = g_array_new (FALSE, FALSE, sizeof (TypeSample));
+
+  /* Only types whose counters changed since the previous sample are written
+   * out, which keeps both the time spent with the lock held and the size of
+   * the output proportional to the activity. */
+  gobject_list_lock ();
+
+  g_hash_table_iter_init (&iter, gobject_list_state.types);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &stats))
+    {
+      TypeSample sample;
+
+      if (stats->created == stats->sampled_created &&
+          stats->finalized == stats->sampled_finalized &&
+          now != 0)
+        continue;
+
+      sample.name = stats->name;
+      sample.live = stats->live;
+      sample.created = stats->created;
+      sample.finalized = stats->finalized;
+      sample.live_bytes = stats->live_bytes;
+      g_array_append_val (samples, sample);
+
+      stats->sampled_created = stats->created;
+      stats->sampled_finalized = stats->finalized;
+    }
+
+  gobject_list_unlock ();
+
+  for (i = 0; i < samples->len; i++)
+    {
+      const TypeSample *sample = &g_array_index (samples, TypeSample, i);
+
+      fprintf (timeseries_file, "%" G_GINT64_FORMAT ",%s,%" G_GUINT64_FORMAT
+          ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT
+          "\n", timestamp, sample->name, sample->live, sample->created,
+          sample->finalized, sample->live_bytes);
+    }
+
+  fflush (timeseries_file);
+  g_array_free (samples, TRUE);
+}
+
+static void
+timeseries_setup (void)
+{
+  const gchar *path = g_getenv ("GOBJECT_LIST_TIMESERIES");
+  const gchar *interval = g_getenv ("GOBJECT_LIST_TIMESERIES_INTERVAL");
+  gint64 interval_ms = 1000;
+
+  if (path == NULL)
+    return;
+
+  timeseries_file = fopen (path, "w");
+  if (timeseries_file == NULL)
+    {
+      g_warning ("Failed to open time series file %s: %s", path,
+          g_strerror (errno));
+      return;
+    }
+
+  if (interval != NULL)
+    interval_ms = MAX (g_ascii_strtoll (interval, NULL, 10), 1);
+
+  fprintf (timeseries_file,
+      "time_us,type,live,created,finalized,live_bytes\n");
+
+  worker_add_task (interval_ms * G_TIME_SPAN_MILLISECOND, timeseries_sample);
+}
+
+/* Write a final, complete sample and close the file. */
+static void
+timeseries_teardown (void)
+{
+  if (timeseries_file == NULL)
+    return;
+
+  timeseries_sample (0);
+  fclose (timeseries_file);
+  timeseries_file = NULL;
+}
+
+static void
+leak_history_push (LeakHistory *history,
+    guint64 live)
+{
+  guint size = leak_detect_windows + 1;
+
+  history->samples[history->next] = live;
+  history->next = (history->next + 1) % size;
+  history->n_samples = MIN (history->n_samples + 1, size);
+}
+
+/* Get the @i-th oldest of the samples in @history. */
+static guint64
+leak_history_get (const LeakHistory *history,
+    guint i)
+{
+  guint size = leak_detect_windows + 1;
+
+  return history->samples[(history->next + size - history->n_samples + i) %
+      size];
+}
+
+/* Decide whether a type is leaking from the live counts at the end of the
+ * last leak_detect_windows windows: the live count must have grown by at
+ * least leak_detect_min_growth and either never decreased, or have a positive
+ * least-squares slope with at least three quarters of the windows rising.
+ * Returns the slope in objects per window in @slope. */
+static gboolean
+leak_history_is_growing (const LeakHistory *history,
+    gdouble *slope)
+{
+  guint n = history->n_samples;
+  gdouble mean_x = (n - 1) / 2.0, mean_y = 0, sxx = 0, sxy = 0;
+  guint rising = 0, falling = 0;
+  guint i;
+
+  *slope = 0;
+
+  if (n < leak_detect_windows + 1)
+    return FALSE;
+
+  for (i = 0; i < n; i++)
+    mean_y += leak_history_get (history, i);
+  mean_y /= n;
+
+  for (i = 0; i < n; i++)
+    {
+      guint64 live = leak_history_get (history, i);
+      gdouble dx = i - mean_x;
+
+      sxx += dx * dx;
+      sxy += dx * (live - mean_y);
+
+      if (i == 0)
+        continue;
+
+      if (live > leak_history_get (history, i - 1))
+        rising++;
+      else if (live < leak_history_get (history, i - 1))
+        falling++;
+    }
+
+  *slope = sxy / sxx;
+
+  if (leak_history_get (history, n - 1) <
+      leak_history_get (history, 0) + leak_detect_min_growth)
+    return FALSE;
+
+  return *slope > 0 && (falling == 0 || rising * 4 >= (n - 1) * 3);
+}
+
+/* Whether the most recent half of the windows are growing, in which case the
+ * creation stacks of the type are recorded so that they are available if an
+ * alert is raised. */
+static gboolean
+leak_history_is_suspect (const LeakHistory *history)
+{
+  guint half = (leak_detect_windows + 1) / 2;
+  guint n = history->n_samples;
+  guint i;
+
+  if (n <= half)
+    return FALSE;
+
+  for (i = n - half; i < n; i++)
+    {
+      if (leak_history_get (history, i) < leak_history_get (history, i - 1))
+        return FALSE;
+    }
+
+  return leak_history_get (history, n - 1) >
+      leak_history_get (history, n - 1 - half);
+}
+
+typedef struct
+{
+  TypeStats *stats;
+  guint64 first_live;
+  guint64 last_live;
+  gdouble rate;  /* objects per second */
+  StackTrace *stacks[LEAK_DETECT_TOP_STACKS];
+  guint stack_counts[LEAK_DETECT_TOP_STACKS];
+} LeakAlert;
+
+/* Find the most common creation stacks of the live objects of @alert’s type.
+ * Must be called with the gobject_list lock held. */
+static void
+leak_alert_find_stacks (LeakAlert *alert)
+{
+  GHashTable *counts;
+  GHashTableIter iter;
+  ObjectInfo *info;
+  gpointer key, value;
+
+  counts = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&iter, gobject_list_state.objects);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &info))
+    {
+      guint count;
+
+      if (info->type != alert->stats || info->stack_id == 0)
+        continue;
+
+      count = GPOINTER_TO_UINT (g_hash_table_lookup (counts,
+          GUINT_TO_POINTER (info->stack_id)));
+      g_hash_table_insert (counts, GUINT_TO_POINTER (info->stack_id),
+          GUINT_TO_POINTER (count + 1));
+    }
+
+  g_hash_table_iter_init (&iter, counts);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint count = GPOINTER_TO_UINT (value);
+      guint i, j;
+
+      for (i = 0; i < LEAK_DETECT_TOP_STACKS; i++)
+        {
+          if (count > alert->stack_counts[i])
+            break;
+        }
+
+      if (i == LEAK_DETECT_TOP_STACKS)
+        continue;
+
+      for (j = LEAK_DETECT_TOP_STACKS - 1; j > i; j--)
+        {
+          alert->stacks[j] = alert->stacks[j - 1];
+          alert->stack_counts[j] = alert->stack_counts[j - 1];
+        }
+
+      alert->stacks[i] = get_stack (GPOINTER_TO_UINT (key));
+      alert->stack_counts[i] = count;
+    }
+
+  g_hash_table_unref (counts);
+}
+
+static void
+leak_alert_print (const LeakAlert *alert)
+{
+  guint i;
+
+  output_lock ();
+
+  g_print ("\nPossible leak of %s: %" G_GUINT64_FORMAT " -> %"
+      G_GUINT64_FORMAT " live objects over %u windows of %" G_GINT64_FORMAT
+      " ms (%+.1f objects/s)\n", alert->stats->name, alert->first_live,
+      alert->last_live, leak_detect_windows,
+      leak_detect_interval / G_TIME_SPAN_MILLISECOND, alert->rate);
+
+  if (alert->stacks[0] == NULL)
+    g_print ("No creation stacks recorded yet\n");
+
+  for (i = 0; i < LEAK_DETECT_TOP_STACKS && alert->stacks[i] != NULL; i++)
+    {
+      g_print ("Created %u times from:\n", alert->stack_counts[i]);
+      print_stack (alert->stacks[i]);
+    }
+
+  output_unlock ();
+}
+
+static void
+leak_detect_window (G_GNUC_UNUSED gint64 now)
+{
+  GHashTableIter iter;
+  TypeStats *stats;
+  GArray *alerts;
+  guint i;
+
+  alerts = g_array_new (FALSE, TRUE, sizeof (LeakAlert));
+
+  gobject_list_lock ();
+
+  g_hash_table_iter_init (&iter, gobject_list_state.types);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &stats))
+    {
+      LeakHistory *history = stats->leak;
+      gdouble slope;
+
+      if (history == NULL)
+        {
+          history = stats->leak = g_new0 (LeakHistory, 1);
+          history->samples = g_new0 (guint64, leak_detect_windows + 1);
+        }
+
+      leak_history_push (history, stats->live);
+      stats->capture_stacks = stats->leak_checked ||
+          dump_mode == DUMP_SITES || leak_history_is_suspect (history);
+
+      /* Alert once per type, and again if the live count doubles. */
+      if (leak_history_is_growing (history, &slope) &&
+          (history->alert_level == 0 ||
+           stats->live >= 2 * history->alert_level))
+        {
+          LeakAlert alert = { NULL, };
+
+          alert.stats = stats;
+          alert.first_live = leak_history_get (history, 0);
+          alert.last_live = stats->live;
+          alert.rate = slope * G_USEC_PER_SEC / leak_detect_interval;
+          leak_alert_find_stacks (&alert);
+          g_array_append_val (alerts, alert);
+
+          history->alert_level = stats->live;
+        }
+    }
+
+  gobject_list_unlock ();
+
+  for (i = 0; i < alerts->len; i++)
+    leak_alert_print (&g_array_index (alerts, LeakAlert, i));
+
+  g_array_free (alerts, TRUE);
+}
+
+static void
+leak_detect_setup (void)
+{
+  const gchar *interval = g_getenv ("GOBJECT_LIST_LEAK_DETECT");
+  const gchar *windows = g_getenv ("GOBJECT_LIST_LEAK_DETECT_WINDOWS");
+  const gchar *min_growth = g_getenv ("GOBJECT_LIST_LEAK_DETECT_MIN_GROWTH");
+
+  if (interval == NULL)
+    return;
+
+  leak_detect_interval = MAX (g_ascii_strtoll (interval, NULL, 10), 1) *
+      G_TIME_SPAN_SECOND;
+
+  if (windows != NULL)
+    leak_detect_windows = MAX (g_ascii_strtoull (windows, NULL, 10), 2);
+  if (min_growth != NULL)
+    leak_detect_min_growth = g_ascii_strtoull (min_growth, NULL, 10);
+
+  worker_add_task (leak_detect_interval, leak_detect_window);
+}
+
+static void
+leak_check_setup (void)
+{
+  const gchar *types = g_getenv ("GOBJECT_LIST_LEAK_CHECK");
+  const gchar *exit_code = g_getenv ("GOBJECT_LIST_LEAK_CHECK_EXIT_CODE");
+
+  if (types == NULL)
+    return;
+
+  if (g_ascii_strcasecmp (types, "all") == 0)
+    leak_check_types = g_new0 (gchar *, 1);
+  else
+    leak_check_types = g_strsplit (types, ",", 0);
+
+  if (exit_code != NULL)
+    leak_check_exit_code = CLAMP (g_ascii_strtoll (exit_code, NULL, 10), 0,
+        255);
+}
+
+/* Objects of one type, for print_object_groups() */
+typedef struct
+{
+  TypeStats *stats;
+  guint64 count;
+  /* stack ID -> (guint64 *) count */
+  GHashTable *stacks;  /* owned */
+} ObjectGroup;
+
+typedef struct
+{
+  guint stack_id;
+  guint64 count;
+} ObjectGroupStack;
+
+static gint
+object_group_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const ObjectGroup *group_a = a, *group_b = b;
+
+  return (group_a->count < group_b->count) - (group_a->count > group_b->count);
+}
+
+static gint
+object_group_stack_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const ObjectGroupStack *stack_a = a, *stack_b = b;
+
+  return (stack_a->count < stack_b->count) - (stack_a->count > stack_b->count);
+}
+
+static void
+print_object_group (const ObjectGroup *group)
+{
+  GArray *stacks;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint i;
+
+  g_print ("%" G_GUINT64_FORMAT " %s\n", group->count, group->stats->name);
+
+  stacks = g_array_new (FALSE, FALSE, sizeof (ObjectGroupStack));
+
+  g_hash_table_iter_init (&iter, group->stacks);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      ObjectGroupStack stack = { GPOINTER_TO_UINT (key), 0 };
+
+      stack.count = *(guint64 *) value;
+      g_array_append_val (stacks, stack);
+    }
+
+  g_array_sort (stacks, object_group_stack_compare);
+
+  for (i = 0; i < stacks->len && i < OBJECT_GROUP_TOP_STACKS; i++)
+    {
+      const ObjectGroupStack *stack =
+          &g_array_index (stacks, ObjectGroupStack, i);
+
+      g_print ("  %" G_GUINT64_FORMAT " created from:\n", stack->count);
+      print_stack (get_stack (stack->stack_id));
+    }
+
+  if (stacks->len > OBJECT_GROUP_TOP_STACKS)
+    g_print ("  (and from %u more stacks)\n",
+        stacks->len - OBJECT_GROUP_TOP_STACKS);
+
+  g_array_unref (stacks);
+}
+
+/* Print @objects, an array of ObjectInfo, grouped by type and creation
+ * stack, the largest groups first. Must be called with the gobject_list lock
+ * held. */
+static void
+print_object_groups (GArray *objects)
+{
+  GHashTable *groups;
+  GArray *sorted;
+  GHashTableIter iter;
+  ObjectGroup *group;
+  guint i;
+
+  /* TypeStats -> (ObjectGroup *) */
+  groups = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  for (i = 0; i < objects->len; i++)
+    {
+      const ObjectInfo *info = &g_array_index (objects, ObjectInfo, i);
+      guint64 *stack_count;
+
+      group = g_hash_table_lookup (groups, info->type);
+      if (group == NULL)
+        {
+          group = g_new0 (ObjectGroup, 1);
+          group->stats = info->type;
+          group->stacks = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+          g_hash_table_insert (groups, info->type, group);
+        }
+
+      group->count += info->weight;
+
+      if (info->stack_id == 0)
+        continue;
+
+      stack_count = g_hash_table_lookup (group->stacks,
+          GUINT_TO_POINTER (info->stack_id));
+      if (stack_count == NULL)
+        {
+          stack_count = g_new0 (guint64, 1);
+          g_hash_table_insert (group->stacks,
+              GUINT_TO_POINTER (info->stack_id), stack_count);
+        }
+
+      *stack_count += info->weight;
+    }
+
+  sorted = g_array_new (FALSE, FALSE, sizeof (ObjectGroup));
+
+  g_hash_table_iter_init (&iter, groups);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &group))
+    g_array_append_val (sorted, *group);
+
+  g_array_sort (sorted, object_group_compare);
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      print_object_group (&g_array_index (sorted, ObjectGroup, i));
+      g_hash_table_unref (g_array_index (sorted, ObjectGroup, i).stacks);
+    }
+
+  g_array_unref (sorted);
+  g_hash_table_unref (groups);
+}
+
+/* Print the objects of the checked types still alive, grouped by type and
+ * creation stack, instead of every object. Returns the number of leaked
+ * objects. */
+static guint64
+leak_check_report (void)
+{
+  GArray *leaks;
+  GHashTableIter iter;
+  ObjectInfo *info;
+  guint64 leaked = 0;
+  guint n_types = 0;
+  GHashTable *types;
+
+  leaks = g_array_new (FALSE, FALSE, sizeof (ObjectInfo));
+  types = g_hash_table_new (NULL, NULL);
+
+  gobject_list_lock ();
+
+  g_hash_table_iter_init (&iter, gobject_list_state.objects);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &info))
+    {
+      if (!info->type->leak_checked)
+        continue;
+
+      g_array_append_val (leaks, *info);
+      g_hash_table_add (types, info->type);
+      leaked += info->weight;
+    }
+
+  n_types = g_hash_table_size (types);
+
+  if (leaked == 0)
+    {
+      g_print ("\ngobject-list leak check of %s: no leaks\n", g_get_prgname ());
+    }
+  else
+    {
+      g_print ("\ngobject-list leak check of %s: %" G_GUINT64_FORMAT
+          " objects of %u types leaked\n", g_get_prgname (), leaked, n_types);
+      print_object_groups (leaks);
+    }
+
+  if (suppressed_objects > 0)
+    g_print ("(%" G_GUINT64_FORMAT " objects were suppressed)\n",
+        suppressed_objects);
+
+  gobject_list_unlock ();
+
+  g_hash_table_unref (types);
+  g_array_unref (leaks);
+
+  return leaked;
+}
+
+static void
+set_sample_rate (guint rate)
+{
+  gobject_list_lock ();
+
+  sample_rate = rate;
+
+  if (shm_header != NULL)
+    {
+      gobject_list_shm_write_begin (shm_header);
+      shm_header->sample_rate = rate;
+      gobject_list_shm_write_end (shm_header);
+    }
+
+  gobject_list_unlock ();
+}
+
+/* Reduce the overhead, cheapest loss of information first: stop recording
+ * reference count changes, then shorten backtraces, then sample fewer
+ * objects. Raising the sampling rate keeps the already tracked objects, and
+ * their weights keep the estimates unbiased. */
+static void
+budget_tighten (gdouble overhead)
+{
+  const gchar *action;
+
+  if (record_refs && display_filter (DISPLAY_FLAG_REFS))
+    {
+      record_refs = FALSE;
+      action = "stopped recording reference count changes";
+    }
+  else if (backtrace_depth > BUDGET_MIN_BACKTRACE_DEPTH)
+    {
+      backtrace_depth = MAX (backtrace_depth / 2, BUDGET_MIN_BACKTRACE_DEPTH);
+      action = "reduced backtrace depth";
+    }
+  else if (sample_rate < BUDGET_MAX_SAMPLE_RATE)
+    {
+      set_sample_rate (MIN (sample_rate * 2, BUDGET_MAX_SAMPLE_RATE));
+      action = "sampling fewer objects";
+    }
+  else
+    {
+      return;
+    }
+
+  g_print ("gobject-list: overhead %.2f%% is over the %.2f%% budget; %s "
+      "(sampling 1 in %u, backtrace depth %u)\n", overhead * 100,
+      overhead_budget * 100, action, sample_rate, backtrace_depth);
+}
+
+/* Undo budget_tighten(), one step at a time, in reverse order. */
+static void
+budget_relax (gdouble overhead)
+{
+  const gchar *action;
+
+  if (sample_rate > base_sample_rate)
+    {
+      set_sample_rate (MAX (sample_rate / 2, base_sample_rate));
+      action = "sampling more objects";
+    }
+  else if (backtrace_depth < MAX_STACK_DEPTH)
+    {
+      backtrace_depth = MIN (backtrace_depth * 2, MAX_STACK_DEPTH);
+      action = "increased backtrace depth";
+    }
+  else if (!record_refs)
+    {
+      record_refs = TRUE;
+      action = "resumed recording reference count changes";
+    }
+  else
+    {
+      return;
+    }
+
+  g_print ("gobject-list: overhead %.2f%% is well under the %.2f%% budget; "
+      "%s (sampling 1 in %u, backtrace depth %u)\n", overhead * 100,
+      overhead_budget * 100, action, sample_rate, backtrace_depth);
+}
+
+static void
+budget_check (G_GNUC_UNUSED gint64 now)
+{
+  static gint64 last_cpu_time = 0, last_hook_time = 0;
+  static guint quiet_intervals = 0;
+  gint64 cpu_time, total_hook_time = 0;
+  gdouble overhead;
+  guint i;
+
+  cpu_time = get_time_ns (CLOCK_PROCESS_CPUTIME_ID);
+  for (i = 0; i < N_HOOKS; i++)
+    total_hook_time += __atomic_load_n (&hook_time[i], __ATOMIC_RELAXED);
+
+  if (last_cpu_time == 0 || cpu_time <= last_cpu_time)
+    {
+      last_cpu_time = cpu_time;
+      last_hook_time = total_hook_time;
+      return;
+    }
+
+  overhead = (gdouble) (total_hook_time - last_hook_time) /
+      (cpu_time - last_cpu_time);
+  last_cpu_time = cpu_time;
+  last_hook_time = total_hook_time;
+
+  if (overhead > overhead_budget)
+    {
+      quiet_intervals = 0;
+      budget_tighten (overhead);
+    }
+  else if (overhead < overhead_budget / 4)
+    {
+      if (++quiet_intervals >= BUDGET_RELAX_INTERVALS)
+        {
+          quiet_intervals = 0;
+          budget_relax (overhead);
+        }
+    }
+  else
+    {
+      quiet_intervals = 0;
+    }
+}
+
+static void
+budget_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_BUDGET");
+
+  if (env == NULL)
+    return;
+
+  /* Accept both ‘2’ and ‘2%’. */
+  overhead_budget = g_ascii_strtod (env, NULL) / 100;
+  if (overhead_budget <= 0)
+    {
+      g_warning ("Invalid GOBJECT_LIST_BUDGET: %s", env);
+      overhead_budget = 0;
+      return;
+    }
+
+  hook_timing = TRUE;
+  worker_add_task (BUDGET_INTERVAL, budget_check);
+}
+
+/* The object retaining @obj in a dump of @hash: its GstObject parent, or for
+ * a pad without a parent, its peer if that one has a parent. NULL for roots.
+ * Must be called with the gobject_list lock held. */
+static gpointer
+retention_owner (GHashTable *hash,
+    gpointer obj)
+{
+  ObjectInfo *info = g_hash_table_lookup (gobject_list_state.objects, obj);
+  GstObject *parent, *peer;
+
+  /* Mini objects have no GType class to check */
+  if (info == NULL || !g_type_is_a (info->type->type, GST_TYPE_OBJECT))
+    return NULL;
+
+  parent = GST_OBJECT_PARENT (obj);
+  if (parent != NULL)
+    return g_hash_table_contains (hash, parent) ? parent : NULL;
+
+  if (!g_type_is_a (info->type->type, GST_TYPE_PAD))
+    return NULL;
+
+  peer = (GstObject *) GST_PAD_PEER (obj);
+  if (peer != NULL && GST_OBJECT_PARENT (peer) != NULL &&
+      g_hash_table_contains (hash, peer))
+    return peer;
+
+  return NULL;
+}
+
+/* Objects retained by a root of a retention dump */
+typedef struct
+{
+  gpointer root;
+  guint count;
+  guint64 bytes;
+  /* (TypeStats *) -> count */
+  GHashTable *types;  /* owned */
+} RetentionRoot;
+
+static gint
+retention_root_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const RetentionRoot *root_a = *(RetentionRoot * const *) a;
+  const RetentionRoot *root_b = *(RetentionRoot * const *) b;
+
+  return (root_a->count < root_b->count) - (root_a->count > root_b->count);
+}
+
+static void
+retention_root_free (RetentionRoot *root)
+{
+  g_hash_table_unref (root->types);
+  g_free (root);
+}
+
+/* Count @weight objects of the type of @stats in @types */
+static void
+count_type (GHashTable *types,
+    TypeStats *stats,
+    guint weight)
+{
+  g_hash_table_insert (types, stats,
+      GUINT_TO_POINTER (GPOINTER_TO_UINT (
+          g_hash_table_lookup (types, stats)) + weight));
+}
+
+/* Count @info as retained by @top in @roots, an object -> RetentionRoot
+ * table, with its weight when sampling. */
+static void
+retention_root_add (GHashTable *roots,
+    gpointer top,
+    const ObjectInfo *info)
+{
+  RetentionRoot *root = g_hash_table_lookup (roots, top);
+
+  if (root == NULL)
+    {
+      root = g_new0 (RetentionRoot, 1);
+      root->root = top;
+      root->types = g_hash_table_new (NULL, NULL);
+      g_hash_table_insert (roots, top, root);
+    }
+
+  root->count += info->weight;
+  root->bytes += (guint64) info->size * info->weight;
+  count_type (root->types, info->type, info->weight);
+}
+
+/* Print the most common types in @types, a TypeStats -> count table. */
+static void
+print_type_counts (GHashTable *types,
+    guint max_types)
+{
+  GArray *sorted;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint i;
+
+  sorted = g_array_new (FALSE, FALSE, sizeof (ObjectGroup));
+
+  g_hash_table_iter_init (&iter, types);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      ObjectGroup group = { key, GPOINTER_TO_UINT (value), NULL };
+
+      g_array_append_val (sorted, group);
+    }
+
+  g_array_sort (sorted, object_group_compare);
+
+  for (i = 0; i < sorted->len && i < max_types; i++)
+    {
+      const ObjectGroup *group = &g_array_index (sorted, ObjectGroup, i);
+
+      g_print ("%s%" G_GUINT64_FORMAT " %s", i > 0 ? ", " : "", group->count,
+          group->stats->name);
+    }
+
+  if (sorted->len > max_types)
+    g_print (", …");
+
+  g_array_unref (sorted);
+}
+
+/* Print the roots of @roots retaining the most objects first, then the
+ * @n_lone objects counted per type in @lone. */
+static void
+print_retention_roots (GHashTable *roots,
+    GHashTable *lone,
+    guint n_lone)
+{
+  GPtrArray *sorted;
+  GHashTableIter iter;
+  RetentionRoot *root;
+  GObject *obj;
+  guint n_retained = 0;
+  guint i;
+
+  sorted = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, roots);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &root))
+    {
+      g_ptr_array_add (sorted, root);
+      n_retained += root->count;
+    }
+  g_ptr_array_sort (sorted, retention_root_compare);
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      root = g_ptr_array_index (sorted, i);
+      obj = root->root;
+
+      GST_ERROR (" - %" GST_PTR_FORMAT " (%p) : %u refs, retaining %u "
+          "objects (%" G_GUINT64_FORMAT " bytes)", obj, obj, obj->ref_count,
+          root->count, root->bytes);
+      g_print ("   ");
+      print_type_counts (root->types, 5);
+      g_print ("\n");
+    }
+
+  if (n_lone > 0)
+    {
+      g_print (" - %u objects retaining nothing: ", n_lone);
+      print_type_counts (lone, 10);
+      g_print ("\n");
+    }
+
+  g_print ("%u roots retaining %u objects, and %u other objects\n",
+      sorted->len, n_retained, n_lone);
+
+  g_ptr_array_unref (sorted);
+}
+
+/* Print only the objects of @hash which nothing else in it retains, each with
+ * the number of objects it retains through GstObject parents and pad peers.
+ * Objects neither retaining nor retained are summed up per type. Must be
+ * called with the gobject_list lock held. */
+static void
+dump_retention (GHashTable *hash)
+{
+  /* object -> (RetentionRoot *) for roots retaining something */
+  GHashTable *roots;
+  /* (TypeStats *) -> count, for the other roots */
+  GHashTable *lone;
+  GHashTableIter iter;
+  GObject *obj;
+  guint n_lone = 0, max_depth = g_hash_table_size (hash);
+
+  roots = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) retention_root_free);
+  lone = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&iter, hash);
+  while (g_hash_table_iter_next (&iter, (gpointer) &obj, NULL))
+    {
+      gpointer top = obj, owner;
+      ObjectInfo *info;
+      guint depth = 0;
+
+      if (obj == NULL || obj->ref_count == 0 ||
+          (info = g_hash_table_lookup (gobject_list_state.objects, obj)) ==
+              NULL)
+        continue;
+
+      while ((owner = retention_owner (hash, top)) != NULL &&
+          depth++ < max_depth)
+        top = owner;
+
+      if (top == obj)
+        continue;
+
+      retention_root_add (roots, top, info);
+    }
+
+  /* Objects which are not retained and retain nothing */
+  g_hash_table_iter_init (&iter, hash);
+  while (g_hash_table_iter_next (&iter, (gpointer) &obj, NULL))
+    {
+      ObjectInfo *info;
+
+      if (obj == NULL || obj->ref_count == 0 ||
+          (info = g_hash_table_lookup (gobject_list_state.objects, obj)) ==
+              NULL ||
+          retention_owner (hash, obj) != NULL ||
+          g_hash_table_contains (roots, obj))
+        continue;
+
+      count_type (lone, info->type, info->weight);
+      n_lone += info->weight;
+    }
+
+  print_retention_roots (roots, lone, n_lone);
+
+  g_hash_table_unref (lone);
+  g_hash_table_unref (roots);
+}
+
+
+static void
+scan_edges_free (ScanEdges *edges)
+{
+  g_array_unref (edges->targets);
+  g_free (edges);
+}
+
+/* Readable object properties of @type, which the deep scan follows. */
+static GPtrArray *
+deep_scan_get_pspecs (GType type)
+{
+  GPtrArray *pspecs;
+  GParamSpec **all;
+  guint n_all, i;
+
+  pspecs = g_hash_table_lookup (scan_pspecs, GSIZE_TO_POINTER (type));
+  if (pspecs != NULL)
+    return pspecs;
+
+  pspecs = g_ptr_array_new ();
+  all = g_object_class_list_properties (g_type_class_peek (type), &n_all);
+
+  for (i = 0; i < n_all; i++)
+    {
+      /* GstObject:parent is followed the other way, by retention_owner() */
+      if (!G_IS_PARAM_SPEC_OBJECT (all[i]) ||
+          !(all[i]->flags & G_PARAM_READABLE) ||
+          (all[i]->flags & G_PARAM_DEPRECATED) ||
+          all[i]->owner_type == GST_TYPE_OBJECT)
+        continue;
+
+      g_ptr_array_add (pspecs, all[i]);
+    }
+
+  g_free (all);
+  g_hash_table_insert (scan_pspecs, GSIZE_TO_POINTER (type), pspecs);
+
+  return pspecs;
+}
+
+/* Record the tracked objects @entry references through its properties, and
+ * return whether it is still alive. The property getters are called without
+ * the gobject_list lock, and with a reference held so that the object cannot
+ * be finalized meanwhile; dropping it may finalize the object, which is fine
+ * in the default main context. */
+static gboolean
+deep_scan_object (const ScanEntry *entry)
+{
+  GWeakRef weak_ref;
+  GObject *obj;
+  ObjectInfo *info;
+  GPtrArray *pspecs;
+  GPtrArray *targets;
+  ScanEdges *edges;
+  guint i;
+
+  gobject_list_lock ();
+
+  info = g_hash_table_lookup (gobject_list_state.objects, entry->obj);
+  if (info == NULL || info->serial != entry->serial ||
+      ((GObject *) entry->obj)->ref_count == 0)
+    {
+      gobject_list_unlock ();
+      return FALSE;
+    }
+
+  g_weak_ref_init (&weak_ref, entry->obj);
+
+  gobject_list_unlock ();
+
+  obj = g_weak_ref_get (&weak_ref);
+  g_weak_ref_clear (&weak_ref);
+
+  if (obj == NULL)
+    return FALSE;
+
+  pspecs = deep_scan_get_pspecs (G_OBJECT_TYPE (obj));
+  targets = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < pspecs->len; i++)
+    {
+      GParamSpec *pspec = g_ptr_array_index (pspecs, i);
+      GValue value = G_VALUE_INIT;
+      GObject *target;
+
+      g_value_init (&value, pspec->value_type);
+      g_object_get_property (obj, pspec->name, &value);
+
+      /* Keep the target alive until its serial is looked up */
+      target = g_value_dup_object (&value);
+      if (target != NULL && target != obj)
+        g_ptr_array_add (targets, target);
+      else if (target != NULL)
+        g_object_unref (target);
+
+      g_value_unset (&value);
+    }
+
+  gobject_list_lock ();
+
+  scan_pass_scanned++;
+  edges = g_hash_table_lookup (scan_edges, &entry->serial);
+
+  for (i = 0; i < targets->len; i++)
+    {
+      info = g_hash_table_lookup (gobject_list_state.objects,
+          g_ptr_array_index (targets, i));
+      if (info == NULL)
+        continue;
+
+      if (edges == NULL)
+        {
+          edges = g_new0 (ScanEdges, 1);
+          edges->serial = entry->serial;
+          edges->targets = g_array_new (FALSE, FALSE, sizeof (guint64));
+          g_hash_table_insert (scan_edges, &edges->serial, edges);
+        }
+      else if (edges->pass != scan_pass)
+        {
+          g_array_set_size (edges->targets, 0);
+        }
+
+      edges->pass = scan_pass;
+      g_array_append_val (edges->targets, info->serial);
+    }
+
+  /* Nothing referenced any more */
+  if (edges != NULL && edges->pass != scan_pass)
+    g_hash_table_remove (scan_edges, &entry->serial);
+
+  gobject_list_unlock ();
+
+  g_ptr_array_unref (targets);
+  g_object_unref (obj);
+
+  return TRUE;
+}
+
+/* Scan the tracked GObjects for GOBJECT_LIST_DUMP=dominators, a few at a
+ * time. Each pass is made of the objects of the previous one found alive,
+ * plus those tracked since it started, so that the registry never has to be
+ * copied as a whole. Edges of objects not seen again by the next pass are
+ * dropped at its end. Runs in the default main context, so that property
+ * getters, disposal and finalization happen where the application expects
+ * them. */
+static gboolean
+deep_scan_slice (G_GNUC_UNUSED gpointer data)
+{
+  gint64 deadline = g_get_monotonic_time () + DEEP_SCAN_BUDGET;
+  GHashTableIter iter;
+  ScanEdges *edges;
+  gboolean resync;
+
+  gobject_list_lock ();
+  scan_slice_scheduled = 0;
+  resync = scan_stalled;
+  scan_stalled = FALSE;
+  gobject_list_unlock ();
+
+  /* Objects tracked while stalled were not kept: start over */
+  if (resync)
+    {
+      g_array_set_size (scan_queue, 0);
+      g_array_set_size (scan_survivors, 0);
+      scan_queue_next = 0;
+    }
+
+  if (scan_queue_next >= scan_queue->len)
+    {
+      GArray *survivors = scan_survivors;
+
+      scan_survivors = scan_queue;
+      scan_queue = survivors;
+      g_array_set_size (scan_survivors, 0);
+      scan_queue_next = 0;
+
+      gobject_list_lock ();
+
+      if (resync)
+        {
+          ObjectInfo *info;
+
+          g_hash_table_iter_init (&iter, gobject_list_state.objects);
+          while (g_hash_table_iter_next (&iter, NULL, (gpointer) &info))
+            {
+              ScanEntry entry = { info->obj, info->serial };
+
+              if (g_type_is_a (info->type->type, G_TYPE_OBJECT))
+                g_array_append_val (scan_queue, entry);
+            }
+        }
+      else
+        {
+          g_array_append_vals (scan_queue, scan_added->data,
+              scan_added->len);
+        }
+      g_array_set_size (scan_added, 0);
+
+      scan_pass++;
+      scan_pass_size = scan_queue->len;
+      scan_pass_scanned = 0;
+
+      gobject_list_unlock ();
+    }
+
+  while (scan_queue_next < scan_queue->len &&
+      g_get_monotonic_time () < deadline)
+    {
+      const ScanEntry *entry = &g_array_index (scan_queue, ScanEntry,
+          scan_queue_next++);
+
+      if (deep_scan_object (entry))
+        g_array_append_vals (scan_survivors, entry, 1);
+    }
+
+  if (scan_queue_next < scan_queue->len)
+    return G_SOURCE_REMOVE;
+
+  gobject_list_lock ();
+
+  g_hash_table_iter_init (&iter, scan_edges);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &edges))
+    {
+      if (edges->pass != scan_pass)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  scan_passes_done++;
+
+  gobject_list_unlock ();
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Schedule the next slice of the deep scan in the default main context,
+ * unless the previous one has not run yet. If it has not run for
+ * DEEP_SCAN_STALL, nothing iterates the context, and the scan is skipped
+ * until something does. */
+static void
+deep_scan_schedule (gint64 now)
+{
+  gboolean schedule = FALSE, stalled = FALSE;
+
+  gobject_list_lock ();
+
+  if (scan_slice_scheduled == 0)
+    {
+      scan_slice_scheduled = now;
+      schedule = TRUE;
+    }
+  else if (!scan_stalled && now - scan_slice_scheduled > DEEP_SCAN_STALL)
+    {
+      scan_stalled = TRUE;
+      stalled = TRUE;
+      g_array_set_size (scan_added, 0);
+    }
+
+  gobject_list_unlock ();
+
+  if (schedule)
+    g_idle_add (deep_scan_slice, NULL);
+  else if (stalled)
+    g_warning ("GOBJECT_LIST_DUMP=dominators: the default main context is "
+        "not running, so object properties are not scanned");
+}
+
+/* Objects of a dump and the references between them, numbered in creation
+ * order, plus a virtual root numbered @n referencing every object nothing
+ * else references. */
+typedef struct
+{
+  guint n;
+  GObject **objs;
+  ObjectInfo **infos;
+  /* Successors of node i are succ[succ_start[i]] to succ[succ_start[i + 1]],
+   * and likewise for predecessors. The virtual root has none listed. */
+  guint *succ_start, *succ;
+  guint *pred_start, *pred;
+  /* Whether the virtual root references the node */
+  gboolean *root_child;
+  guint *post;  /* postorder number of each node */
+  guint *order;  /* nodes by postorder */
+  guint *idom;  /* immediate dominator of each node */
+} DominatorGraph;
+
+static gint
+object_info_ptr_serial_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const ObjectInfo *info_a = *(ObjectInfo * const *) a;
+  const ObjectInfo *info_b = *(ObjectInfo * const *) b;
+
+  return (info_a->serial > info_b->serial) - (info_a->serial < info_b->serial);
+}
+
+/* Build the CSR arrays of @graph from @edges, pairs of (from, to) nodes. */
+static void
+dominator_graph_set_edges (DominatorGraph *graph,
+    GArray *edges)
+{
+  guint *succ_fill, *pred_fill;
+  guint i;
+
+  graph->succ_start = g_new0 (guint, graph->n + 2);
+  graph->pred_start = g_new0 (guint, graph->n + 2);
+  graph->succ = g_new (guint, MAX (edges->len / 2, 1));
+  graph->pred = g_new (guint, MAX (edges->len / 2, 1));
+
+  for (i = 0; i < edges->len; i += 2)
+    {
+      graph->succ_start[g_array_index (edges, guint, i) + 1]++;
+      graph->pred_start[g_array_index (edges, guint, i + 1) + 1]++;
+    }
+
+  for (i = 1; i <= graph->n + 1; i++)
+    {
+      graph->succ_start[i] += graph->succ_start[i - 1];
+      graph->pred_start[i] += graph->pred_start[i - 1];
+    }
+
+  succ_fill = g_new (guint, graph->n + 1);
+  pred_fill = g_new (guint, graph->n + 1);
+  memcpy (succ_fill, graph->succ_start, (graph->n + 1) * sizeof (guint));
+  memcpy (pred_fill, graph->pred_start, (graph->n + 1) * sizeof (guint));
+
+  for (i = 0; i < edges->len; i += 2)
+    {
+      guint from = g_array_index (edges, guint, i);
+      guint to = g_array_index (edges, guint, i + 1);
+
+      graph->succ[succ_fill[from]++] = to;
+      graph->pred[pred_fill[to]++] = from;
+    }
+
+  g_free (succ_fill);
+  g_free (pred_fill);
+}
+
+/* Number the nodes reachable from @start in postorder, continuing from
+ * @n_post. Iterative, as the graph may be millions of nodes deep. */
+static void
+dominator_graph_dfs (DominatorGraph *graph,
+    guint start,
+    guint *n_post,
+    GArray *stack)
+{
+  /* Pairs of (node, index of the next successor to visit) */
+  guint top[2] = { start, graph->succ_start[start] };
+
+  graph->post[start] = G_MAXUINT - 1;  /* on the stack */
+  g_array_append_vals (stack, top, 2);
+
+  while (stack->len > 0)
+    {
+      guint *node = &g_array_index (stack, guint, stack->len - 2);
+      guint *next = node + 1;
+
+      if (*next < graph->succ_start[*node + 1])
+        {
+          guint succ = graph->succ[(*next)++];
+
+          if (graph->post[succ] == G_MAXUINT)
+            {
+              guint pair[2] = { succ, graph->succ_start[succ] };
+
+              graph->post[succ] = G_MAXUINT - 1;
+              g_array_append_vals (stack, pair, 2);
+            }
+        }
+      else
+        {
+          graph->post[*node] = *n_post;
+          graph->order[(*n_post)++] = *node;
+          g_array_set_size (stack, stack->len - 2);
+        }
+    }
+}
+
+static guint
+dominator_graph_intersect (const DominatorGraph *graph,
+    guint a,
+    guint b)
+{
+  while (a != b)
+    {
+      while (graph->post[a] < graph->post[b])
+        a = graph->idom[a];
+      while (graph->post[b] < graph->post[a])
+        b = graph->idom[b];
+    }
+
+  return a;
+}
+
+/* Compute @graph->idom, after Cooper, Harvey and Kennedy, “A Simple, Fast
+ * Dominance Algorithm”. Objects only referenced from cycles are made
+ * children of the virtual root, oldest first. */
+static void
+dominator_graph_compute (DominatorGraph *graph)
+{
+  GArray *stack = g_array_new (FALSE, FALSE, sizeof (guint));
+  guint root = graph->n;
+  guint n_post = 0;
+  gboolean changed = TRUE;
+  guint i;
+
+  graph->post = g_new (guint, graph->n + 1);
+  graph->order = g_new (guint, graph->n + 1);
+  graph->idom = g_new (guint, graph->n + 1);
+  graph->root_child = g_new0 (gboolean, graph->n);
+
+  for (i = 0; i <= graph->n; i++)
+    {
+      graph->post[i] = G_MAXUINT;
+      graph->idom[i] = G_MAXUINT;
+    }
+
+  for (i = 0; i < graph->n; i++)
+    {
+      if (graph->pred_start[i] == graph->pred_start[i + 1])
+        {
+          graph->root_child[i] = TRUE;
+          dominator_graph_dfs (graph, i, &n_post, stack);
+        }
+    }
+
+  for (i = 0; i < graph->n; i++)
+    {
+      if (graph->post[i] == G_MAXUINT)
+        {
+          graph->root_child[i] = TRUE;
+          dominator_graph_dfs (graph, i, &n_post, stack);
+        }
+    }
+
+  graph->post[root] = n_post;
+  graph->order[n_post] = root;
+  graph->idom[root] = root;
+
+  while (changed)
+    {
+      changed = FALSE;
+
+      /* Reverse postorder, skipping the root */
+      for (i = n_post; i-- > 0;)
+        {
+          guint node = graph->order[i];
+          guint new_idom = graph->root_child[node] ? root : G_MAXUINT;
+          guint j;
+
+          for (j = graph->pred_start[node]; j < graph->pred_start[node + 1];
+              j++)
+            {
+              guint pred = graph->pred[j];
+
+              if (graph->idom[pred] == G_MAXUINT)
+                continue;
+
+              new_idom = (new_idom == G_MAXUINT) ? pred :
+                  dominator_graph_intersect (graph, new_idom, pred);
+            }
+
+          if (graph->idom[node] != new_idom)
+            {
+              graph->idom[node] = new_idom;
+              changed = TRUE;
+            }
+        }
+    }
+
+  g_array_unref (stack);
+}
+
+static void
+dominator_graph_free (DominatorGraph *graph)
+{
+  g_free (graph->objs);
+  g_free (graph->infos);
+  g_free (graph->succ_start);
+  g_free (graph->succ);
+  g_free (graph->pred_start);
+  g_free (graph->pred);
+  g_free (graph->root_child);
+  g_free (graph->post);
+  g_free (graph->order);
+  g_free (graph->idom);
+}
+
+/* As dump_retention(), but an object is retained by whichever object all
+ * references to it go through: its dominator in the graph of GstObject
+ * parents, pad peers and the object properties found by the deep scan. Must
+ * be called with the gobject_list lock held. */
+static void
+dump_dominators (GHashTable *hash)
+{
+  DominatorGraph graph = { 0, };
+  /* (guint64 *) serial -> node, and object -> node */
+  GHashTable *by_serial, *by_obj;
+  /* object -> (RetentionRoot *) for roots retaining something */
+  GHashTable *roots;
+  /* (TypeStats *) -> count, for the other roots */
+  GHashTable *lone;
+  GArray *edges;
+  GPtrArray *infos;
+  guint *top;
+  GHashTableIter iter;
+  GObject *obj;
+  guint n_lone = 0;
+  guint i, j;
+
+  infos = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, hash);
+  while (g_hash_table_iter_next (&iter, (gpointer) &obj, NULL))
+    {
+      ObjectInfo *info;
+
+      if (obj == NULL || obj->ref_count == 0 ||
+          (info = g_hash_table_lookup (gobject_list_state.objects, obj)) ==
+              NULL)
+        continue;
+
+      g_ptr_array_add (infos, info);
+    }
+
+  g_ptr_array_sort (infos, object_info_ptr_serial_compare);
+
+  graph.n = infos->len;
+  graph.infos = (ObjectInfo **) g_ptr_array_free (infos, FALSE);
+  graph.objs = g_new (GObject *, MAX (graph.n, 1));
+
+  by_serial = g_hash_table_new (g_int64_hash, g_int64_equal);
+  by_obj = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < graph.n; i++)
+    {
+      graph.objs[i] = graph.infos[i]->obj;
+      g_hash_table_insert (by_serial, &graph.infos[i]->serial,
+          GUINT_TO_POINTER (i));
+      g_hash_table_insert (by_obj, graph.objs[i], GUINT_TO_POINTER (i));
+    }
+
+  edges = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (i = 0; i < graph.n; i++)
+    {
+      ScanEdges *scanned;
+      gpointer owner, node;
+
+      owner = retention_owner (hash, graph.objs[i]);
+      if (owner != NULL &&
+          g_hash_table_lookup_extended (by_obj, owner, NULL, &node))
+        {
+          guint pair[2] = { GPOINTER_TO_UINT (node), i };
+
+          g_array_append_vals (edges, pair, 2);
+        }
+
+      scanned = g_hash_table_lookup (scan_edges, &graph.infos[i]->serial);
+      for (j = 0; scanned != NULL && j < scanned->targets->len; j++)
+        {
+          if (g_hash_table_lookup_extended (by_serial,
+                  &g_array_index (scanned->targets, guint64, j), NULL, &node) &&
+              GPOINTER_TO_UINT (node) != i)
+            {
+              guint pair[2] = { i, GPOINTER_TO_UINT (node) };
+
+              g_array_append_vals (edges, pair, 2);
+            }
+        }
+    }
+
+  dominator_graph_set_edges (&graph, edges);
+  g_array_unref (edges);
+  g_hash_table_unref (by_serial);
+  g_hash_table_unref (by_obj);
+
+  dominator_graph_compute (&graph);
+
+  /* The child of the virtual root dominating each node, in reverse
+   * postorder so that dominators come first */
+  top = g_new (guint, MAX (graph.n, 1));
+  roots = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) retention_root_free);
+  lone = g_hash_table_new (NULL, NULL);
+
+  for (i = graph.n; i-- > 0;)
+    {
+      guint node = graph.order[i];
+
+      top[node] = (graph.idom[node] == graph.n) ? node :
+          top[graph.idom[node]];
+
+      if (top[node] != node)
+        retention_root_add (roots, graph.objs[top[node]], graph.infos[node]);
+    }
+
+  for (i = 0; i < graph.n; i++)
+    {
+      if (top[i] == i && !g_hash_table_contains (roots, graph.objs[i]))
+        {
+          count_type (lone, graph.infos[i]->type, graph.infos[i]->weight);
+          n_lone += graph.infos[i]->weight;
+        }
+    }
+
+  g_print ("Deep scan: %u passes done, %u of %u objects scanned in the "
+      "current one\n", scan_passes_done, scan_pass_scanned, scan_pass_size);
+  print_retention_roots (roots, lone, n_lone);
+
+  g_free (top);
+  g_hash_table_unref (lone);
+  g_hash_table_unref (roots);
+  dominator_graph_free (&graph);
+}
+
+/* Live objects of one type created from one stack, for dump_sites() */
+typedef struct
+{
+  TypeStats *stats;
+  guint stack_id;
+  guint64 count;
+  guint64 bytes;
+  gint64 oldest;  /* monotonic creation times */
+  gint64 newest;
+} CreationSite;
+
+static guint
+creation_site_hash (gconstpointer key)
+{
+  const CreationSite *site = key;
+
+  return g_direct_hash (site->stats) ^ (site->stack_id * 2654435761u);
+}
+
+static gboolean
+creation_site_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const CreationSite *site_a = a, *site_b = b;
+
+  return site_a->stats == site_b->stats && site_a->stack_id == site_b->stack_id;
+}
+
+static gint
+creation_site_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const CreationSite *site_a = *(CreationSite * const *) a;
+  const CreationSite *site_b = *(CreationSite * const *) b;
+
+  if (dump_sites_by_bytes && site_a->bytes != site_b->bytes)
+    return (site_a->bytes < site_b->bytes) - (site_a->bytes > site_b->bytes);
+
+  return (site_a->count < site_b->count) - (site_a->count > site_b->count);
+}
+
+/* Print the objects of @hash grouped by type and creation stack, one entry
+ * per group with the stack printed once, the largest groups first. Must be
+ * called with the gobject_list lock held. */
+static void
+dump_sites (GHashTable *hash)
+{
+  /* (CreationSite *) -> itself */
+  GHashTable *sites;
+  GPtrArray *sorted;
+  GHashTableIter iter;
+  GObject *obj;
+  CreationSite *site;
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  sites = g_hash_table_new_full (creation_site_hash, creation_site_equal,
+      g_free, NULL);
+
+  g_hash_table_iter_init (&iter, hash);
+  while (g_hash_table_iter_next (&iter, (gpointer) &obj, NULL))
+    {
+      CreationSite key = { NULL, };
+      ObjectInfo *info;
+
+      if (obj == NULL || obj->ref_count == 0 ||
+          (info = g_hash_table_lookup (gobject_list_state.objects, obj)) ==
+              NULL)
+        continue;
+
+      key.stats = info->type;
+      key.stack_id = info->stack_id;
+
+      site = g_hash_table_lookup (sites, &key);
+      if (site == NULL)
+        {
+          site = g_new (CreationSite, 1);
+          *site = key;
+          site->oldest = info->time;
+          site->newest = info->time;
+          g_hash_table_add (sites, site);
+        }
+
+      site->count += info->weight;
+      site->bytes += (guint64) info->size * info->weight;
+      site->oldest = MIN (site->oldest, info->time);
+      site->newest = MAX (site->newest, info->time);
+    }
+
+  sorted = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, sites);
+  while (g_hash_table_iter_next (&iter, (gpointer) &site, NULL))
+    g_ptr_array_add (sorted, site);
+  g_ptr_array_sort (sorted, creation_site_compare);
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      site = g_ptr_array_index (sorted, i);
+
+      g_print (" - %" G_GUINT64_FORMAT " %s (%" G_GUINT64_FORMAT " bytes), "
+          "aged %.1f to %.1f s, created from:\n", site->count,
+          site->stats->name, site->bytes,
+          (gdouble) (now - site->newest) / G_USEC_PER_SEC,
+          (gdouble) (now - site->oldest) / G_USEC_PER_SEC);
+
+      if (site->stack_id != 0)
+        print_stack (get_stack (site->stack_id));
+      else
+        g_print ("   (stack not recorded)\n");
+    }
+
+  g_print ("%u creation sites\n", sorted->len);
+
+  g_ptr_array_unref (sorted);
+  g_hash_table_unref (sites);
+}
+
+static void
+_dump_object_list (GHashTable *hash)
+{
+  GHashTableIter iter;
+  GObject *obj;
+  ObjectInfo *info;
+
+  if (dump_mode == DUMP_RETENTION)
+    {
+      dump_retention (hash);
+    }
+  else if (dump_mode == DUMP_DOMINATORS)
+    {
+      dump_dominators (hash);
+    }
+  else if (dump_mode == DUMP_SITES)
+    {
+      dump_sites (hash);
+    }
+  else
+    {
+      g_hash_table_iter_init (&iter, hash);
+      while (g_hash_table_iter_next (&iter, (gpointer) &obj, NULL))
+        {
+          /* FIXME: Not really sure how we get to this state. */
+          if (obj == NULL || obj->ref_count == 0)
+            continue;
+
+          info = g_hash_table_lookup (gobject_list_state.objects, obj);
+
+          GST_ERROR (" - %" GST_PTR_FORMAT " (%p) : %u refs, serial %"
+              G_GUINT64_FORMAT "%s", obj, obj, obj->ref_count,
+              (info != NULL) ? info->serial : 0,
+              (info != NULL && info->unknown_origin) ?
+                  " (unknown origin)" : "");
+        }
+    }
+  g_print ("%u objects\n", g_hash_table_size (hash));
+
+  if (sample_rate > 1)
+    g_print ("(only 1 in %u objects is tracked; about %" G_GUINT64_FORMAT
+        " objects in total)\n", sample_rate,
+        (guint64) g_hash_table_size (hash) * sample_rate);
+
+  if (attached_objects > 0)
+    g_print ("(%" G_GUINT64_FORMAT " objects alive when attaching are not "
+        "tracked)\n", attached_objects);
+
+  if (suppressed_objects > 0)
+    g_print ("(%" G_GUINT64_FORMAT " objects were suppressed)\n",
+        suppressed_objects);
+
+  if (unarmed_objects > 0)
+    g_print ("(%" G_GUINT64_FORMAT " objects created before arming are not "
+        "tracked)\n", unarmed_objects);
+}
+
+/* Counters of a type at a checkpoint */
+typedef struct
+{
+  guint64 created;
+  guint64 finalized;
+} CheckpointCounts;
+
+struct _GObjectListCheckpoint
+{
+  guint64 serial;  /* first serial tracked after the checkpoint */
+  gint64 time;  /* monotonic */
+  gchar *name;  /* owned; NULL unless saved */
+  /* (TypeStats *) -> (CheckpointCounts *), for every type known then */
+  GHashTable *counts;  /* owned */
+};
+
+/* Saved checkpoints, in the order they were saved. Never freed, so that
+ * pointers to them stay valid, except for those saved on SIGUSR2: only the
+ * last USR2_CHECKPOINTS_KEPT are kept, in @usr2_ring. Protected by the
+ * gobject_list lock. */
+#define USR2_CHECKPOINTS_KEPT 4
+
+static GPtrArray *saved_checkpoints = NULL;  /* owned */
+static guint usr2_checkpoints = 0;
+static GObjectListCheckpoint *usr2_ring[USR2_CHECKPOINTS_KEPT];  /* unowned */
+
+/* Whether @info is of @type, or of any type if @type is G_TYPE_INVALID, and
+ * was tracked at or after @serial but before @end_serial. */
+static inline gboolean
+object_matches (const ObjectInfo *info,
+    guint64 serial,
+    guint64 end_serial,
+    GType type)
+{
+  return info->serial >= serial && info->serial < end_serial &&
+      (type == G_TYPE_INVALID || g_type_is_a (info->type->type, type));
+}
+
+static gint
+object_info_compare_serial (gconstpointer a,
+    gconstpointer b)
+{
+  const ObjectInfo *info_a = a, *info_b = b;
+
+  return (info_a->serial > info_b->serial) - (info_a->serial < info_b->serial);
+}
+
+/* Returns a copy of the information about each tracked object matched by
+ * object_matches(), in creation order. Must be called with the gobject_list
+ * lock held. */
+static GArray *
+collect_objects (guint64 serial,
+    guint64 end_serial,
+    GType type)
+{
+  GArray *objects;
+  GHashTableIter iter;
+  ObjectInfo *info;
+
+  objects = g_array_new (FALSE, FALSE, sizeof (ObjectInfo));
+
+  g_hash_table_iter_init (&iter, gobject_list_state.objects);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &info))
+    {
+      if (object_matches (info, serial, end_serial, type))
+        g_array_append_val (objects, *info);
+    }
+
+  g_array_sort (objects, object_info_compare_serial);
+
+  return objects;
+}
+
+/* Must be called with the gobject_list lock held. */
+static GObjectListCheckpoint *
+checkpoint_create (const gchar *name)
+{
+  GObjectListCheckpoint *checkpoint;
+  GHashTableIter iter;
+  TypeStats *stats;
+
+  checkpoint = g_new0 (GObjectListCheckpoint, 1);
+  checkpoint->serial = gobject_list_state.next_serial;
+  checkpoint->time = g_get_monotonic_time ();
+  checkpoint->name = g_strdup (name);
+  checkpoint->counts = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  g_hash_table_iter_init (&iter, gobject_list_state.types);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &stats))
+    {
+      CheckpointCounts *counts = g_new (CheckpointCounts, 1);
+
+      counts->created = stats->created;
+      counts->finalized = stats->finalized;
+      g_hash_table_insert (checkpoint->counts, stats, counts);
+    }
+
+  return checkpoint;
+}
+
+static void
+checkpoint_free (GObjectListCheckpoint *checkpoint)
+{
+  g_hash_table_unref (checkpoint->counts);
+  g_free (checkpoint->name);
+  g_free (checkpoint);
+}
+
+/* Must be called with the gobject_list lock held. */
+static GObjectListCheckpoint *
+checkpoint_save (const gchar *name)
+{
+  GObjectListCheckpoint *checkpoint = checkpoint_create (name);
+
+  if (saved_checkpoints == NULL)
+    saved_checkpoints = g_ptr_array_new ();
+
+  g_ptr_array_add (saved_checkpoints, checkpoint);
+
+  return checkpoint;
+}
+
+/* Changes of a type between two checkpoints, for checkpoint_print_diff() */
+typedef struct
+{
+  const gchar *name;
+  guint64 created;
+  guint64 finalized;
+} CheckpointDiff;
+
+static gint
+checkpoint_diff_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const CheckpointDiff *diff_a = a, *diff_b = b;
+  gint64 live_a = diff_a->created - diff_a->finalized;
+  gint64 live_b = diff_b->created - diff_b->finalized;
+
+  if (live_a != live_b)
+    return (live_a < live_b) - (live_a > live_b);
+
+  return g_strcmp0 (diff_a->name, diff_b->name);
+}
+
+/* Print the per-type changes between @from and @to, or now if @to is NULL,
+ * then the objects tracked in between which are still alive. The older of
+ * the two is taken as the start. Neither checkpoint is modified. Must be
+ * called with the gobject_list lock held. */
+static void
+checkpoint_print_diff (const GObjectListCheckpoint *from,
+    const GObjectListCheckpoint *to)
+{
+  GArray *diffs, *objects;
+  GHashTableIter iter;
+  TypeStats *stats;
+  guint64 end_serial;
+  gint64 end_time;
+  guint i;
+
+  if (to != NULL && from->serial > to->serial)
+    {
+      const GObjectListCheckpoint *tmp = from;
+
+      from = to;
+      to = tmp;
+    }
+
+  end_serial = (to != NULL) ? to->serial : gobject_list_state.next_serial;
+  end_time = (to != NULL) ? to->time : g_get_monotonic_time ();
+
+  g_print ("\nChanges from checkpoint ‘%s’ to %s%s%s (%" G_GINT64_FORMAT
+      " ms):\n", from->name != NULL ? from->name : "(unnamed)",
+      (to != NULL) ? "checkpoint ‘" : "now",
+      (to != NULL) ? (to->name != NULL ? to->name : "(unnamed)") : "",
+      (to != NULL) ? "’" : "",
+      (end_time - from->time) / G_TIME_SPAN_MILLISECOND);
+
+  diffs = g_array_new (FALSE, FALSE, sizeof (CheckpointDiff));
+
+  g_hash_table_iter_init (&iter, gobject_list_state.types);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &stats))
+    {
+      const CheckpointCounts *start, *end;
+      CheckpointCounts now = { stats->created, stats->finalized };
+      CheckpointDiff diff = { stats->name, 0, 0 };
+
+      start = g_hash_table_lookup (from->counts, stats);
+      end = (to != NULL) ? g_hash_table_lookup (to->counts, stats) : &now;
+
+      /* Not known yet at @to */
+      if (end == NULL)
+        continue;
+
+      diff.created = end->created - (start != NULL ? start->created : 0);
+      diff.finalized = end->finalized - (start != NULL ? start->finalized : 0);
+
+      if (diff.created > 0 || diff.finalized > 0)
+        g_array_append_val (diffs, diff);
+    }
+
+  g_array_sort (diffs, checkpoint_diff_compare);
+
+  g_print ("%-40s %10s %10s %10s\n", "type", "created", "finalized", "live");
+  for (i = 0; i < diffs->len; i++)
+    {
+      const CheckpointDiff *diff = &g_array_index (diffs, CheckpointDiff, i);
+
+      g_print ("%-40s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+          " %+10" G_GINT64_FORMAT "\n", diff->name, diff->created,
+          diff->finalized, (gint64) (diff->created - diff->finalized));
+    }
+
+  g_array_unref (diffs);
+
+  g_print ("\nCreated in between and still alive:\n");
+
+  objects = collect_objects (from->serial, end_serial, G_TYPE_INVALID);
+
+  for (i = 0; i < objects->len; i++)
+    {
+      const ObjectInfo *info = &g_array_index (objects, ObjectInfo, i);
+      GObject *obj = info->obj;
+
+      GST_ERROR (" - %" GST_PTR_FORMAT " (%p) : %u refs%s", obj, obj,
+          obj->ref_count, info->unknown_origin ? " (unknown origin)" : "");
+    }
+
+  g_print ("%u objects\n", objects->len);
+
+  g_array_unref (objects);
+}
+
+/* Must be called with the gobject_list lock held. */
+static void
+arm (const gchar *reason)
+{
+  if (armed)
+    return;
+
+  checkpoint_save ("armed");
+  g_atomic_int_set (&armed, TRUE);
+
+  g_print ("gobject-list armed (%s); %" G_GUINT64_FORMAT " objects created "
+      "before are not tracked\n", reason, unarmed_objects);
+}
+
+/* Whether to track an object of @type being created, arming first if this
+ * is a trigger. Must be called with the gobject_list lock held. */
+static gboolean
+creation_armed (GType type,
+    guint weight)
+{
+  TypeStats *stats;
+
+  if (G_LIKELY (armed))
+    return TRUE;
+
+  stats = get_type_stats (type);
+
+  if (stats->arm_trigger)
+    {
+      arm (stats->name);
+      return TRUE;
+    }
+
+  if (arm_time != 0 && g_get_monotonic_time () >= arm_time)
+    {
+      arm ("delay");
+      return TRUE;
+    }
+
+  stats->unarmed += weight;
+  unarmed_objects += weight;
+
+  return FALSE;
+}
+
+/* Only flags the request: arming takes the lock and allocates, which is not
+ * async-signal-safe */
+static void
+_sig_arm_handler (G_GNUC_UNUSED int signal)
+{
+  g_atomic_int_set (&arm_requested, TRUE);
+}
+
+static void
+arm_poll (G_GNUC_UNUSED gint64 now)
+{
+  if (!g_atomic_int_compare_and_exchange (&arm_requested, TRUE, FALSE))
+    return;
+
+  gobject_list_lock ();
+  arm ("signal");
+  gobject_list_unlock ();
+}
+
+static void
+arming_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_ARM");
+  GPtrArray *types;
+  gchar **tokens;
+  guint i;
+
+  if (env == NULL)
+    return;
+
+  types = g_ptr_array_new ();
+  tokens = g_strsplit (env, ",", 0);
+
+  for (i = 0; tokens[i] != NULL; i++)
+    {
+      const gchar *token = g_strstrip (tokens[i]);
+
+      if (g_str_has_prefix (token, "delay:"))
+        arm_time = g_get_monotonic_time () +
+            g_ascii_strtoll (token + strlen ("delay:"), NULL, 10) *
+            G_TIME_SPAN_SECOND;
+      else if (g_str_has_prefix (token, "type:"))
+        g_ptr_array_add (types, g_strdup (token + strlen ("type:")));
+      else if (strcmp (token, "signal") == 0)
+        {
+          if (!attaching)
+            {
+              signal (SIGRTMIN + 1, _sig_arm_handler);
+              worker_add_task (ARM_POLL_INTERVAL, arm_poll);
+            }
+        }
+      else if (strcmp (token, "api") != 0)
+        g_warning ("Invalid GOBJECT_LIST_ARM trigger: %s", token);
+    }
+
+  g_strfreev (tokens);
+
+  if (types->len > 0)
+    {
+      g_ptr_array_add (types, NULL);
+      arm_types = (gchar **) g_ptr_array_free (types, FALSE);
+    }
+  else
+    {
+      g_ptr_array_free (types, TRUE);
+    }
+
+  armed = FALSE;
+}
+
+static void
+dump_mode_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_DUMP");
+
+  if (env == NULL || g_ascii_strcasecmp (env, "list") == 0)
+    dump_mode = DUMP_LIST;
+  else if (g_ascii_strcasecmp (env, "retention") == 0)
+    dump_mode = DUMP_RETENTION;
+  else if (g_ascii_strcasecmp (env, "dominators") == 0)
+    dump_mode = DUMP_DOMINATORS;
+  else if (g_ascii_strcasecmp (env, "sites") == 0)
+    dump_mode = DUMP_SITES;
+  else if (g_ascii_strcasecmp (env, "sites:bytes") == 0)
+    {
+      dump_mode = DUMP_SITES;
+      dump_sites_by_bytes = TRUE;
+    }
+  else
+    g_warning ("Invalid GOBJECT_LIST_DUMP value: %s", env);
+
+  if (dump_mode == DUMP_DOMINATORS)
+    {
+      scan_edges = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+          (GDestroyNotify) scan_edges_free);
+      scan_added = g_array_new (FALSE, FALSE, sizeof (ScanEntry));
+      scan_queue = g_array_new (FALSE, FALSE, sizeof (ScanEntry));
+      scan_survivors = g_array_new (FALSE, FALSE, sizeof (ScanEntry));
+      scan_pspecs = g_hash_table_new (NULL, NULL);
+      worker_add_task (DEEP_SCAN_INTERVAL, deep_scan_schedule);
+    }
+}
+
+static void
+triggers_setup (void)
+{
+  const gchar *env = g_getenv ("GOBJECT_LIST_TRIGGERS");
+  const gchar *duration = g_getenv ("GOBJECT_LIST_TRIGGER_DURATION");
+  gchar **tokens;
+  guint i;
+
+  if (env == NULL)
+    return;
+
+  if (duration != NULL)
+    trigger_duration = MAX (g_ascii_strtoll (duration, NULL, 10), 1) *
+        G_TIME_SPAN_SECOND;
+
+  triggers = g_array_new (FALSE, FALSE, sizeof (Trigger));
+  tokens = g_strsplit (env, ",", 0);
+
+  for (i = 0; tokens[i] != NULL; i++)
+    {
+      const gchar *token = g_strstrip (tokens[i]);
+      Trigger trigger = { TRIGGER_LIVE, NULL, 0, FALSE };
+      const gchar *threshold;
+
+      if (g_str_has_prefix (token, "serial:"))
+        {
+          trigger.kind = TRIGGER_SERIAL;
+          trigger.value = g_ascii_strtoull (token + strlen ("serial:"), NULL,
+              10);
+        }
+      else if ((g_str_has_prefix (token, "live:") ||
+                g_str_has_prefix (token, "refcount:")) &&
+               (threshold = strchr (token, '>')) != NULL)
+        {
+          const gchar *name = strchr (token, ':') + 1;
+
+          trigger.kind = (token[0] == 'l') ? TRIGGER_LIVE : TRIGGER_REFCOUNT;
+          trigger.type_name = g_strndup (name, threshold - name);
+          trigger.value = g_ascii_strtoull (threshold + 1, NULL, 10);
+        }
+      else
+        {
+          g_warning ("Invalid GOBJECT_LIST_TRIGGERS trigger: %s", token);
+          continue;
+        }
+
+      if (trigger.kind != TRIGGER_LIVE)
+        ref_triggers_pending++;
+
+      g_array_append_val (triggers, trigger);
+    }
+
+  g_strfreev (tokens);
+
+  trace_refs = (ref_triggers_pending > 0);
+}
+
+/* Print the current stack as print_stack() does, without interning it, so
+ * that the gobject_list lock is not needed. */
+static void
+print_current_stack (void)
+{
+  StackTrace *stack;
+  gint n_frames;
+
+  stack = g_alloca (sizeof (StackTrace) + MAX_STACK_DEPTH * sizeof (gpointer));
+
+#ifdef HAVE_LIBUNWIND
+  n_frames = unw_backtrace (stack->frames, MAX_STACK_DEPTH);
+#else
+  n_frames = backtrace (stack->frames, MAX_STACK_DEPTH);
+#endif
+
+  stack->n_frames = MAX (n_frames, 0);
+  print_stack (stack);
+}
+
+/* Check the ref triggers for @obj, whose ref count is going from @ref_count
+ * by @delta, and print the ref with a backtrace if the object or its type is
+ * being traced. Only called while trace_refs is set. */
+static void
+trace_ref (gpointer obj,
+    gint ref_count,
+    gint delta)
+{
+  ObjectInfo *info;
+  gint64 now;
+  gboolean traced = FALSE;
+  guint64 serial = 0;
+  guint i;
+
+  /* Called back while printing objects with the lock held */
+  if (gobject_list_locked)
+    return;
+
+  now = g_get_monotonic_time ();
+
+  gobject_list_lock ();
+
+  info = g_hash_table_lookup (gobject_list_state.objects, obj);
+
+  if (info != NULL && info->trace_until == 0)
+    {
+      for (i = 0; triggers != NULL && i < triggers->len; i++)
+        {
+          Trigger *trigger = &g_array_index (triggers, Trigger, i);
+
+          if (trigger->kind == TRIGGER_SERIAL && !trigger->fired &&
+              trigger->value == info->serial)
+            {
+              g_print ("gobject-list trigger: object %p with serial %"
+                  G_GUINT64_FORMAT " reffed; tracing it for %" G_GINT64_FORMAT
+                  " s\n", obj, info->serial,
+                  trigger_duration / G_TIME_SPAN_SECOND);
+              info->trace_until = now + trigger_duration;
+              trace_refs_extend (info->trace_until);
+              trigger->fired = TRUE;
+              ref_triggers_pending--;
+            }
+        }
+
+      if (info->trace_until == 0 && info->type->refcount_trigger != 0 &&
+          ref_count + delta > (gint) info->type->refcount_trigger)
+        {
+          g_print ("gobject-list trigger: %s %p ref count %d > %u; tracing "
+              "it for %" G_GINT64_FORMAT " s\n", info->type->name, obj,
+              ref_count + delta, info->type->refcount_trigger,
+              trigger_duration / G_TIME_SPAN_SECOND);
+          info->trace_until = now + trigger_duration;
+          trace_refs_extend (info->trace_until);
+        }
+    }
+
+  if (info != NULL)
+    {
+      traced = now < info->trace_until || now < info->type->trace_until;
+      serial = info->serial;
+    }
+
+  /* Nothing left to trigger nor to trace: back to the fast path */
+  if (ref_triggers_pending == 0 && now >= trace_refs_until)
+    g_atomic_int_set (&trace_refs, FALSE);
+
+  gobject_list_unlock ();
+
+  if (!traced)
+    return;
+
+  output_lock ();
+
+  g_print (" %s  Traced object %p (serial %" G_GUINT64_FORMAT "); ref_count: "
+      "%d -> %d\n", delta > 0 ? "+" : "-", obj, serial, ref_count,
+      ref_count + delta);
+  print_current_stack ();
+
+  output_unlock ();
+}
+
+static void
+_sig_usr1_handler (G_GNUC_UNUSED int signal)
+{
+  g_print ("Living Objects:\n");
+
+  gobject_list_lock ();
+  _dump_object_list (gobject_list_state.objects);
+  gobject_list_unlock ();
+
+  print_self_stats ();
+}
+
+static void
+_sig_usr2_handler (G_GNUC_UNUSED int signal)
+{
+  GHashTableIter iter;
+  gpointer obj, type;
+
+  gobject_list_lock ();
+
+  g_print ("Added Objects:\n");
+  _dump_object_list (gobject_list_state.added);
+
+  g_print ("\nRemoved Objects:\n");
+  g_hash_table_iter_init (&iter, gobject_list_state.removed);
+  while (g_hash_table_iter_next (&iter, &obj, &type))
+    {
+      GST_ERROR (" - %" GST_PTR_FORMAT "(%p)", obj, obj);
+    }
+  g_print ("%u objects\n", g_hash_table_size (gobject_list_state.removed));
+
+  g_hash_table_remove_all (gobject_list_state.added);
+  g_hash_table_remove_all (gobject_list_state.removed);
+
+  {
+    GObjectListCheckpoint **slot;
+    gchar name[32];
+
+    slot = &usr2_ring[usr2_checkpoints % USR2_CHECKPOINTS_KEPT];
+    if (*slot != NULL)
+      {
+        g_ptr_array_remove (saved_checkpoints, *slot);
+        checkpoint_free (*slot);
+      }
+
+    g_snprintf (name, sizeof (name), "usr2-%u", ++usr2_checkpoints);
+    *slot = checkpoint_save (name);
+    g_print ("\nSaved new check point ‘%s’\n", name);
+  }
+
+  gobject_list_unlock ();
+}
+
+static void
+print_still_alive (void)
+{
+  g_print ("\nStill Alive in %s:\n", g_get_prgname());
+
+  gobject_list_lock ();
+  _dump_object_list (gobject_list_state.objects);
+  gobject_list_unlock ();
+}
+
+static void
+_exiting (void)
+{
+  guint64 leaked = 0;
+
+  worker_stop ();
+  timeseries_teardown ();
+
+  if (leak_check_types != NULL)
+    leaked = leak_check_report ();
+  else
+    print_still_alive ();
+
+  print_self_stats ();
+  shm_teardown ();
+
+  /* There is no way to change the exit status from here but to exit again.
+   * This skips the atexit() handlers registered before this one. */
+  if (leaked > 0 && leak_check_exit_code != 0)
+    {
+      fflush (stdout);
+      fflush (stderr);
+      _exit (leak_check_exit_code);
+    }
+}
+
+/* Handle signals which terminate the process. We’re technically not allowed to
+ * call printf() from this signal handler, but we do anyway as it’s only a
+ * best-effort debugging tool. */
+static void
+_sig_bad_handler (int sig_num)
+{
+  signal (sig_num, SIG_DFL);
+  print_still_alive ();
+  raise (sig_num);
+}
+
+/* Wrappers which are also installed by GOT rewriting. The library is linked
+ * with -Bsymbolic-functions so that these are the addresses of the wrappers,
+ * even when another definition comes first in the lookup scope. */
+static const GObjectListGotHook got_hooks[] =
+{
+  { "g_object_new", (gpointer) g_object_new },
+  { "g_object_ref", (gpointer) g_object_ref },
+  { "g_object_unref", (gpointer) g_object_unref },
+  { "gst_init", (gpointer) gst_init },
+  { "gst_init_check", (gpointer) gst_init_check },
+  { "gst_buffer_new", (gpointer) gst_buffer_new },
+  { "gst_buffer_new_allocate", (gpointer) gst_buffer_new_allocate },
+  { "gst_buffer_new_wrapped_full", (gpointer) gst_buffer_new_wrapped_full },
+  { "gst_mini_object_init", (gpointer) gst_mini_object_init },
+  { "gst_mini_object_ref", (gpointer) gst_mini_object_ref },
+  { "gst_mini_object_unref", (gpointer) gst_mini_object_unref },
+};
+
+/* Functions whose entry is patched in trampoline mode, to see the calls made
+ * from within their own library */
+static const struct
+{
+  const char *library;
+  const char *name;
+  gpointer replacement;
+} trampoline_hooks[] =
+{
+  { "libgobject-2.0.so.0", "g_object_new", (gpointer) g_object_new },
+  { "libgobject-2.0.so.0", "g_object_ref", (gpointer) g_object_ref },
+  { "libgobject-2.0.so.0", "g_object_unref", (gpointer) g_object_unref },
+  { "libgstreamer-1.0.so.0", "gst_mini_object_init",
+    (gpointer) gst_mini_object_init },
+  { "libgstreamer-1.0.so.0", "gst_mini_object_ref",
+    (gpointer) gst_mini_object_ref },
+  { "libgstreamer-1.0.so.0", "gst_mini_object_unref",
+    (gpointer) gst_mini_object_unref },
+};
+
+static void
+trampoline_setup (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (trampoline_hooks); i++)
+    {
+      void *handle;
+      gpointer target;
+
+      /* Not through get_func(), which would call back into hook_setup() */
+      handle = dlopen (trampoline_hooks[i].library, RTLD_LAZY | RTLD_NOLOAD);
+      if (handle == NULL)
+        continue;
+
+      target = dlsym (handle, trampoline_hooks[i].name);
+      if (target != NULL &&
+          !gobject_list_trampoline_install (target,
+              trampoline_hooks[i].replacement))
+        g_warning ("Failed to install a trampoline for %s",
+            trampoline_hooks[i].name);
+
+      dlclose (handle);
+    }
+}
+
+static void
+hooks_install (void)
+{
+  if ((hook_modes & HOOK_MODE_GOT) &&
+      !gobject_list_got_install (got_hooks, G_N_ELEMENTS (got_hooks)))
+    g_warning ("GOT rewriting is not supported on this platform");
+
+  if (hook_modes & HOOK_MODE_TRAMPOLINE)
+    trampoline_setup ();
+}
+
+static void
+hooks_uninstall (void)
+{
+  gobject_list_got_uninstall ();
+  gobject_list_trampoline_uninstall ();
+}
+
+/* Install the hooks selected with GOBJECT_LIST_HOOK on top of LD_PRELOAD.
+ * This must not be called with the gobject_list lock held, as walking the
+ * loaded objects takes the dynamic linker lock. */
+static void
+hook_setup (void)
+{
+  static gsize once = 0;
+
+  if (g_once_init_enter (&once))
+    {
+      const gchar *env = g_getenv ("GOBJECT_LIST_HOOK");
+      gchar **tokens;
+      guint i;
+
+      tokens = g_strsplit (env != NULL ? env : "", ",", 0);
+
+      for (i = 0; tokens[i] != NULL; i++)
+        {
+          if (g_ascii_strcasecmp (tokens[i], "got") == 0)
+            hook_modes |= HOOK_MODE_GOT;
+          else if (g_ascii_strcasecmp (tokens[i], "trampoline") == 0)
+            hook_modes |= HOOK_MODE_TRAMPOLINE;
+          else if (g_ascii_strcasecmp (tokens[i], "preload") != 0)
+            g_warning ("Invalid GOBJECT_LIST_HOOK value: %s", tokens[i]);
+        }
+
+      g_strfreev (tokens);
+
+      /* Installed when tracking is switched on otherwise */
+      if (tracking_enabled)
+        hooks_install ();
+
+      g_once_init_leave (&once, 1);
+    }
+}
+
+/* Switch tracking on or off. While off, the hooks only call the real
+ * functions, and the GOT entries and function entries patched for
+ * GOBJECT_LIST_HOOK are restored; switching on installs them, including when
+ * hook_setup() left them pending because tracking started off. Tracked
+ * objects are still untracked when finalized, so the registry stays
+ * consistent; objects created while off are tracked with an unknown origin
+ * if seen by a hook within ADOPT_WINDOW of switching back on. Switching on
+ * starts a new checkpoint. */
+static void
+tracking_set_enabled (gboolean enabled)
+{
+  if (enabled == g_atomic_int_get (&tracking_enabled))
+    return;
+
+  if (enabled)
+    {
+      hooks_install ();
+
+      gobject_list_lock ();
+      g_hash_table_remove_all (gobject_list_state.added);
+      g_hash_table_remove_all (gobject_list_state.removed);
+      adopt_until = g_get_monotonic_time () + ADOPT_WINDOW;
+      gobject_list_unlock ();
+
+      g_atomic_int_set (&tracking_enabled, TRUE);
+    }
+  else
+    {
+      g_atomic_int_set (&adopt_untracked, TRUE);
+      g_atomic_int_set (&tracking_enabled, FALSE);
+
+      hooks_uninstall ();
+    }
+}
+
+/* Only flags the request: switching is not async-signal-safe */
+static void
+_sig_toggle_handler (G_GNUC_UNUSED int signal)
+{
+  g_atomic_int_set (&toggle_requested, TRUE);
+}
+
+static void
+toggle_poll (G_GNUC_UNUSED gint64 now)
+{
+  gboolean enabled;
+
+  if (!g_atomic_int_compare_and_exchange (&toggle_requested, TRUE, FALSE))
+    return;
+
+  enabled = !g_atomic_int_get (&tracking_enabled);
+  tracking_set_enabled (enabled);
+  g_print ("gobject-list tracking %s\n", enabled ? "enabled" : "disabled");
+}
+
+/* SIGRTMIN only toggles tracking if GOBJECT_LIST_TOGGLE_SIGNAL is set, as the
+ * application may use it itself. */
+static void
+toggle_setup (void)
+{
+  if (g_getenv ("GOBJECT_LIST_TOGGLE_SIGNAL") == NULL || attaching)
+    return;
+
+  signal (SIGRTMIN, _sig_toggle_handler);
+  worker_add_task (TOGGLE_POLL_INTERVAL, toggle_poll);
+}
+
+/* Returns the entry of @func_name in GLib, which may be patched to jump back
+ * to the wrapper; see get_func(). */
+static void *
+lookup_func (const char *func_name)
+{
+  static void *handle = NULL;
+  void *func;
+  char *error;
 
-  g_hash_table_remove (gobject_list_state.objects, obj);
-  g_hash_table_remove (gobject_list_state.added, obj);
+  gobject_list_lock ();
 
-  G_UNLOCK (gobject_list);
+  if (G_UNLIKELY (g_once_init_enter (&handle)))
+    {
+      void *_handle;
+
+      _handle = dlopen("libgobject-2.0.so.0", RTLD_LAZY);
+
+      if (_handle == NULL)
+        g_error ("Failed to open libgobject-2.0.so.0: %s", dlerror ());
+
+      /* set up signal handlers */
+      if (!attaching)
+        {
+          signal (SIGUSR1, _sig_usr1_handler);
+          signal (SIGUSR2, _sig_usr2_handler);
+          signal (SIGINT, _sig_bad_handler);
+          signal (SIGTERM, _sig_bad_handler);
+          signal (SIGABRT, _sig_bad_handler);
+          signal (SIGSEGV, _sig_bad_handler);
+        }
+
+      /* set up objects map */
+      gobject_list_state.objects = g_hash_table_new_full (NULL, NULL, NULL,
+          g_free);
+      gobject_list_state.types = g_hash_table_new_full (NULL, NULL, NULL,
+          g_free);
+      gobject_list_state.added = g_hash_table_new (NULL, NULL);
+      gobject_list_state.removed = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+      gobject_list_state.stacks = g_hash_table_new (stack_trace_hash,
+          stack_trace_equal);
+      gobject_list_state.stacks_by_id = g_ptr_array_new ();
+
+      if (g_strcmp0 (g_getenv ("GOBJECT_LIST_ENABLED"), "0") == 0)
+        {
+          tracking_enabled = FALSE;
+          adopt_untracked = TRUE;
+        }
+
+      sampling_setup ();
+      shm_setup ();
+      timeseries_setup ();
+      leak_detect_setup ();
+      leak_check_setup ();
+      suppressions_setup ();
+      pipeline_cycles_setup ();
+      arming_setup ();
+      triggers_setup ();
+      dump_mode_setup ();
+      toggle_setup ();
+      self_stats_setup ();
+      budget_setup ();
+      worker_start ();
+
+      /* Set up exit handler */
+      atexit (_exiting);
+
+      /* Prevent propagation to child processes. Other threads may be
+       * reading the environment when attaching, and LD_PRELOAD is not ours
+       * then anyway. */
+      if (!attaching && g_getenv ("GOBJECT_PROPAGATE_LD_PRELOAD") == NULL)
+        {
+          g_unsetenv ("LD_PRELOAD");
+        }
+
+      g_once_init_leave (&handle, _handle);
+    }
+
+  gobject_list_unlock ();
+
+  /* Before looking up @func_name, which may get patched */
+  hook_setup ();
+
+  func = dlsym (handle, func_name);
+
+  if ((error = dlerror ()) != NULL)
+    g_error ("Failed to find symbol: %s", error);
+
+  return func;
+}
+
+static void *
+lookup_gst_func (const char *func_name)
+{
+  static void *handle = NULL;
+  void *func;
+  char *error;
+
+  if (G_UNLIKELY (g_once_init_enter (&handle)))
+    {
+      void *_handle;
+
+      _handle = dlopen("libgstreamer-1.0.so.0", RTLD_LAZY);
+
+      if (_handle == NULL)
+        g_error ("Failed to open libgstreamer-1.0.so.0: %s", dlerror ());
+
+      g_once_init_leave (&handle, _handle);
+    }
+
+  func = dlsym (handle, func_name);
+
+  if ((error = dlerror ()) != NULL)
+    g_error ("Failed to find symbol: %s", error);
+
+  return func;
+}
+
+static void *
+get_func (const char *func_name)
+{
+  /* The entry of the real function may jump back to the wrapper */
+  return gobject_list_trampoline_get_original (lookup_func (func_name));
+}
+
+static void *
+get_gst_func (const char *func_name)
+{
+  return gobject_list_trampoline_get_original (lookup_gst_func (func_name));
+}
+
+/* As get_func() or get_gst_func(), for the hooks called on every object:
+ * the symbol is only looked up once, into @entry. Whether the entry is
+ * patched is still checked on every call, as trampolines come and go with
+ * tracking_set_enabled(). */
+static void *
+get_cached_func (gpointer *entry,
+    void * (* lookup) (const char *func_name),
+    const char *func_name)
+{
+  void *func = g_atomic_pointer_get (entry);
+
+  if (G_UNLIKELY (func == NULL))
+    {
+      func = lookup (func_name);
+      g_atomic_pointer_set (entry, func);
+    }
+
+  return gobject_list_trampoline_get_original (func);
+}
+
+static void
+_object_finalized (G_GNUC_UNUSED gpointer data,
+    gpointer obj)
+{
+  ObjectInfo *info;
+  HookTimer timer;
+
+  hook_timer_start (&timer);
+
+  gobject_list_lock ();
+
+  info = g_hash_table_lookup (gobject_list_state.objects, obj);
+
+  if (display_filter (DISPLAY_FLAG_CREATE))
+    {
+      output_lock ();
+
+
+      GST_ERROR (" -- Finalized %" GST_PTR_FORMAT "(%p)", obj, obj);
+      print_trace();
+
+      output_unlock ();
+
+      /* Only care about the object which were already existing during last
+       * check point. */
+      if (info != NULL &&
+          g_hash_table_lookup (gobject_list_state.added, obj) == NULL)
+        g_hash_table_insert (gobject_list_state.removed, obj,
+            g_strdup (info->type->name));
+    }
+
+  if (info != NULL)
+    unregister_object (info);
+
+  gobject_list_unlock ();
+
+  hook_timer_stop (&timer, HOOK_FINALIZE);
+}
+
+/* Track @obj if it is not tracked yet, after tracking was switched back on:
+ * it was most likely created while tracking was off. Its creation stack is
+ * unknown, and it does not count towards the objects added since the last
+ * checkpoint. Only done without sampling, as the object would otherwise have
+ * been skipped by sample_creation() anyway most of the time, and not for
+ * types with objects created before arming, which were skipped on purpose. */
+static void
+adopt_object (gpointer obj,
+    GType type,
+    gboolean is_mini_object)
+{
+  TypeStats *stats;
+  ObjectInfo *info;
+  gsize size;
+
+  if (sample_rate != 1 || !armed || gobject_list_locked)
+    return;
+
+  if (is_mini_object)
+    {
+      size = mini_object_size (type);
+    }
+  else
+    {
+      GTypeQuery query;
+
+      g_type_query (type, &query);
+      size = query.instance_size;
+    }
+
+  gobject_list_lock ();
+
+  /* Objects created while off have had their chance by now. Suppressed
+   * objects are never registered, and the stack of this ref is not their
+   * creation stack, so they are left alone. */
+  if (adopt_until != 0 && g_get_monotonic_time () > adopt_until)
+    g_atomic_int_set (&adopt_untracked, FALSE);
+  else if ((stats = get_type_stats (type))->suppress == SUPPRESS_NONE &&
+      stats->unarmed == 0 &&
+      g_hash_table_lookup (gobject_list_state.objects, obj) == NULL &&
+      object_filter (g_type_name (type)))
+    {
+      info = register_object (obj, type, size, 1);
+      if (info != NULL)
+        {
+          if (is_mini_object)
+            gst_mini_object_weak_ref (obj,
+                (GstMiniObjectNotify) _object_finalized, NULL);
+          else
+            g_object_weak_ref (obj, (GWeakNotify) _object_finalized, NULL);
+
+          info->unknown_origin = TRUE;
+          info->stack_id = 0;
+          g_hash_table_remove (gobject_list_state.added, obj);
+        }
+    }
+
+  gobject_list_unlock ();
 }
 
 gpointer
@@ -345,160 +4612,460 @@ g_object_new (GType type,
     const char *first,
     ...)
 {
+  static gpointer real_entry = NULL;
   gpointer (* real_g_object_new_valist) (GType, const char *, va_list);
   va_list var_args;
   GObject *obj;
   const char *obj_name;
+  GTypeQuery query;
+  guint weight;
+  HookTimer timer;
+
+  real_g_object_new_valist = get_cached_func (&real_entry, lookup_func,
+      "g_object_new_valist");
+
+  if (G_UNLIKELY (!tracking_enabled))
+    {
+      va_start (var_args, first);
+      obj = real_g_object_new_valist (type, first, var_args);
+      va_end (var_args);
 
-  real_g_object_new_valist = get_func ("g_object_new_valist");
+      return obj;
+    }
+
+  hook_timer_start (&timer);
 
   va_start (var_args, first);
+  hook_timer_real_begin (&timer);
   obj = real_g_object_new_valist (type, first, var_args);
+  hook_timer_real_end (&timer);
   va_end (var_args);
 
+  weight = sample_creation ();
+  if (weight == 0)
+    {
+      hook_timer_stop (&timer, HOOK_OBJECT_NEW);
+      return obj;
+    }
+
   obj_name = G_OBJECT_TYPE_NAME (obj);
+  g_type_query (G_OBJECT_TYPE (obj), &query);
 
-  G_LOCK (gobject_list);
+  gobject_list_lock ();
 
-  if (g_hash_table_lookup (gobject_list_state.objects, obj) == NULL &&
+  if (creation_armed (G_OBJECT_TYPE (obj), weight) &&
+      g_hash_table_lookup (gobject_list_state.objects, obj) == NULL &&
       object_filter (obj_name))
     {
       if (display_filter (DISPLAY_FLAG_CREATE))
         {
-          g_mutex_lock(&output_mutex);
+          output_lock ();
+
+          GST_ERROR (" ++ Created object %" GST_PTR_FORMAT "(%p)", obj, obj);
+          print_trace();
+
+          output_unlock ();
+        }
+
+      /* FIXME: For thread safety, GWeakRef should be used here, except it
+       * won’t give us notify callbacks. Perhaps an opportunistic combination
+       * of GWeakRef and g_object_weak_ref() — the former for safety, the latter
+       * for notifications (with the knowledge that due to races, some
+       * notifications may get omitted)?
+       *
+       * Alternatively, we could abuse GToggleRef. Inadvisable because other
+       * code could be using it.
+       *
+       * Alternatively, we could switch to a garbage-collection style of
+       * working, where gobject-list runs in its own thread and uses GWeakRefs
+       * to keep track of objects. Periodically, it would check the hash table
+       * and notify of which references have been nullified. */
+      if (register_object (obj, G_OBJECT_TYPE (obj), query.instance_size,
+              weight) != NULL)
+        g_object_weak_ref (obj, (GWeakNotify)_object_finalized, NULL);
+    }
+
+  gobject_list_unlock ();
+
+  hook_timer_stop (&timer, HOOK_OBJECT_NEW);
+
+  return obj;
+}
+
+gpointer
+g_object_ref (gpointer object)
+{
+  static gpointer real_entry = NULL;
+  gpointer (* real_g_object_ref) (gpointer);
+  GObject *obj = G_OBJECT (object);
+  const char *obj_name;
+  guint ref_count;
+  GObject *ret;
+  HookTimer timer;
+
+  real_g_object_ref = get_cached_func (&real_entry, lookup_func,
+      "g_object_ref");
+
+  if (G_UNLIKELY (!tracking_enabled))
+    return real_g_object_ref (object);
+
+  hook_timer_start (&timer);
+
+  obj_name = G_OBJECT_TYPE_NAME (obj);
+
+  ref_count = obj->ref_count;
+  hook_timer_real_begin (&timer);
+  ret = real_g_object_ref (object);
+  hook_timer_real_end (&timer);
+
+  if (G_UNLIKELY (adopt_untracked))
+    adopt_object (obj, G_OBJECT_TYPE (obj), FALSE);
+
+  if (G_UNLIKELY (trace_refs))
+    trace_ref (obj, ref_count, 1);
+
+  if (record_refs && object_filter (obj_name) &&
+      display_filter (DISPLAY_FLAG_REFS))
+    {
+      output_lock ();
+
+      GST_ERROR (" +  Reffed object %" GST_PTR_FORMAT "(%p); ref_count: %d -> %d",
+          obj, obj, ref_count, ref_count + 1);
+      print_trace();
+
+      output_unlock ();
+    }
+
+  hook_timer_stop (&timer, HOOK_OBJECT_REF);
+
+  return ret;
+}
+
+void
+g_object_unref (gpointer object)
+{
+  static gpointer real_entry = NULL;
+  void (* real_g_object_unref) (gpointer);
+  GObject *obj = G_OBJECT (object);
+  gint ref_count;
+  const char *obj_name;
+  HookTimer timer;
+
+  real_g_object_unref = get_cached_func (&real_entry, lookup_func,
+      "g_object_unref");
+
+  if (G_UNLIKELY (!tracking_enabled))
+    {
+      real_g_object_unref (object);
+      return;
+    }
+
+  hook_timer_start (&timer);
+
+  obj_name = G_OBJECT_TYPE_NAME (obj);
+  ref_count = obj->ref_count;
+
+  /* Not about to be finalized, so worth tracking */
+  if (G_UNLIKELY (adopt_untracked) && ref_count > 1)
+    adopt_object (obj, G_OBJECT_TYPE (obj), FALSE);
+
+  if (G_UNLIKELY (trace_refs))
+    trace_ref (obj, ref_count, -1);
+
+  if (record_refs && object_filter (obj_name) &&
+      display_filter (DISPLAY_FLAG_REFS))
+    {
+      output_lock ();
+
+      GST_ERROR (" -  Unreffed object %" GST_PTR_FORMAT "(%p); ref_count: %d -> %d\n",
+          obj, obj, ref_count, ref_count - 1);
+      print_trace();
+
+      output_unlock ();
+    }
+
+  /* The object may be finalized by the real call, which in turn calls
+   * _object_finalized(). That time is accounted to HOOK_FINALIZE. */
+  hook_timer_stop (&timer, HOOK_OBJECT_UNREF);
+
+  real_g_object_unref (object);
+}
+
+static gpointer
+new_mini_object(GstMiniObject *mini_object)
+{
+  guint weight;
+  GType type;
+  HookTimer timer;
+
+  if (!g_atomic_int_get (&tracking_enabled))
+    return (gpointer) mini_object;
+
+  weight = sample_creation ();
+  if (weight == 0)
+    return (gpointer) mini_object;
+
+  hook_timer_start (&timer);
+
+  type = GST_MINI_OBJECT_TYPE (mini_object);
+
+  gobject_list_lock ();
+  if (!creation_armed (type, weight)) {
+    gobject_list_unlock ();
+    hook_timer_stop (&timer, HOOK_MINI_OBJECT_NEW);
+    return (gpointer) mini_object;
+  }
+  if (display_filter(DISPLAY_FLAG_CREATE) && object_filter(g_type_name(type))) {
+    GST_ERROR("Created %s(%p)", g_type_name (type), mini_object);
+    print_trace();
+  }
+  if (register_object (mini_object, type, mini_object_size (type), weight))
+    gst_mini_object_weak_ref (mini_object, (GstMiniObjectNotify)_object_finalized, NULL);
+  gobject_list_unlock ();
+
+  hook_timer_stop (&timer, HOOK_MINI_OBJECT_NEW);
+
+  return (gpointer) mini_object;
+}
+
+/* Calls from inside libgstreamer to gst_mini_object_init() do not go through
+ * the PLT, so overriding it only catches the few mini objects created by
+ * subclasses outside of GStreamer core. Instead, a tracer hooked to
+ * "mini-object-created" is installed once GStreamer is initialised; it sees
+ * every mini object (caps, events, queries, messages, buffer lists, samples,
+ * memories, contexts, tag lists...) right after gst_mini_object_init(). With
+ * GOBJECT_LIST_STATE_CHECKPOINTS, it is also hooked to
+ * "element-change-state-post". */
+#ifndef GST_DISABLE_GST_TRACER_HOOKS
+typedef GstTracer GObjectListTracer;
+typedef GstTracerClass GObjectListTracerClass;
+
+static GType gobject_list_tracer_get_type (void);
+G_DEFINE_TYPE (GObjectListTracer, gobject_list_tracer, GST_TYPE_TRACER)
+
+static void
+gobject_list_tracer_class_init (G_GNUC_UNUSED GObjectListTracerClass *klass)
+{
+}
+
+static void
+gobject_list_tracer_init (G_GNUC_UNUSED GObjectListTracer *self)
+{
+}
+
+static void
+tracer_mini_object_created (G_GNUC_UNUSED GstTracer *self,
+    G_GNUC_UNUSED GstClockTime ts,
+    GstMiniObject *mini_object)
+{
+  if (g_atomic_int_get (&tracking_enabled))
+    new_mini_object (mini_object);
+}
 
-          GST_ERROR (" ++ Created object %" GST_PTR_FORMAT "(%p)", obj, obj);
-          print_trace();
+/* Print the objects created while the pipeline of @cycle was PLAYING which
+ * are still alive now that it is back to NULL. Must be called with the
+ * gobject_list lock held. */
+static void
+pipeline_cycle_report (const gchar *name,
+    const PipelineCycle *cycle)
+{
+  GArray *objects;
+  guint64 count = 0;
+  guint i;
 
-          g_mutex_unlock(&output_mutex);
-        }
+  objects = collect_objects (cycle->playing->serial, cycle->paused->serial,
+      G_TYPE_INVALID);
 
-      /* FIXME: For thread safety, GWeakRef should be used here, except it
-       * won’t give us notify callbacks. Perhaps an opportunistic combination
-       * of GWeakRef and g_object_weak_ref() — the former for safety, the latter
-       * for notifications (with the knowledge that due to races, some
-       * notifications may get omitted)?
-       *
-       * Alternatively, we could abuse GToggleRef. Inadvisable because other
-       * code could be using it.
-       *
-       * Alternatively, we could switch to a garbage-collection style of
-       * working, where gobject-list runs in its own thread and uses GWeakRefs
-       * to keep track of objects. Periodically, it would check the hash table
-       * and notify of which references have been nullified. */
-      g_object_weak_ref (obj, (GWeakNotify)_object_finalized, NULL);
+  for (i = 0; i < objects->len; i++)
+    count += g_array_index (objects, ObjectInfo, i).weight;
 
-      g_hash_table_insert (gobject_list_state.objects, obj,
-          GUINT_TO_POINTER (TRUE));
-      g_hash_table_insert (gobject_list_state.added, obj,
-          GUINT_TO_POINTER (TRUE));
-    }
+  output_lock ();
 
-  G_UNLOCK (gobject_list);
+  g_print ("\nPipeline ‘%s’, cycle %u: %" G_GUINT64_FORMAT " objects created "
+      "while PLAYING are still alive in NULL\n", name, cycle->cycle, count);
+  print_object_groups (objects);
 
-  return obj;
+  output_unlock ();
+
+  g_array_unref (objects);
 }
 
-gpointer
-g_object_ref (gpointer object)
+/* Forget the checkpoints of the current cycle of @cycle */
+static void
+pipeline_cycle_reset (PipelineCycle *cycle)
 {
-  gpointer (* real_g_object_ref) (gpointer);
-  GObject *obj = G_OBJECT (object);
-  const char *obj_name;
-  guint ref_count;
-  GObject *ret;
-
-  real_g_object_ref = get_func ("g_object_ref");
+  g_clear_pointer (&cycle->playing, checkpoint_free);
+  g_clear_pointer (&cycle->paused, checkpoint_free);
+}
 
-  obj_name = G_OBJECT_TYPE_NAME (obj);
+/* Called when a bin in @pipeline_cycles is disposed, before its address can
+ * be reused by another one. */
+static void
+pipeline_cycle_bin_disposed (G_GNUC_UNUSED gpointer data,
+    GObject *bin)
+{
+  PipelineCycle *cycle;
 
-  ref_count = obj->ref_count;
-  ret = real_g_object_ref (object);
+  gobject_list_lock ();
 
-  if (object_filter (obj_name) && display_filter (DISPLAY_FLAG_REFS))
+  cycle = g_hash_table_lookup (pipeline_cycles, bin);
+  if (cycle != NULL)
     {
-      g_mutex_lock(&output_mutex);
-
-      GST_ERROR (" +  Reffed object %" GST_PTR_FORMAT "(%p); ref_count: %d -> %d",
-          obj, obj, ref_count, ref_count + 1);
-      print_trace();
-
-      g_mutex_unlock(&output_mutex);
+      if (cycle->is_playing)
+        pipelines_playing--;
+      pipeline_cycle_reset (cycle);
+      g_hash_table_remove (pipeline_cycles, bin);
     }
 
-  return ret;
+  gobject_list_unlock ();
 }
 
-void
-g_object_unref (gpointer object)
+/* Take a checkpoint when a top-level bin starts and stops PLAYING, and check
+ * at the end of each PLAYING→NULL cycle which objects created while PLAYING
+ * survived it. The hook runs for each single-step transition, including
+ * those completing asynchronously. */
+static void
+tracer_element_change_state_post (G_GNUC_UNUSED GstTracer *self,
+    G_GNUC_UNUSED GstClockTime ts,
+    GstElement *element,
+    GstStateChange transition,
+    GstStateChangeReturn result)
 {
-  void (* real_g_object_unref) (gpointer);
-  GObject *obj = G_OBJECT (object);
-  gint ref_count;
-  const char *obj_name;
+  PipelineCycle *cycle;
+  gchar *name;
+
+  if (!g_atomic_int_get (&tracking_enabled) ||
+      result == GST_STATE_CHANGE_FAILURE ||
+      GST_OBJECT_PARENT (element) != NULL || !GST_IS_BIN (element))
+    return;
 
-  real_g_object_unref = get_func ("g_object_unref");
+  name = gst_object_get_name (GST_OBJECT (element));
 
-  obj_name = G_OBJECT_TYPE_NAME (obj);
-  ref_count = obj->ref_count;
+  gobject_list_lock ();
 
-  if (object_filter (obj_name) && display_filter (DISPLAY_FLAG_REFS))
+  cycle = g_hash_table_lookup (pipeline_cycles, element);
+  if (cycle == NULL)
     {
-      g_mutex_lock(&output_mutex);
+      cycle = g_new0 (PipelineCycle, 1);
+      cycle->cycle = 1;
+      g_hash_table_insert (pipeline_cycles, element, cycle);
+      g_object_weak_ref (G_OBJECT (element), pipeline_cycle_bin_disposed,
+          NULL);
+    }
 
-      GST_ERROR (" -  Unreffed object %" GST_PTR_FORMAT "(%p); ref_count: %d -> %d\n",
-          obj, obj, ref_count, ref_count - 1);
-      print_trace();
+  switch (transition)
+    {
+      case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+        if (cycle->playing == NULL)
+          cycle->playing = checkpoint_create (NULL);
+        if (!cycle->is_playing)
+          {
+            cycle->is_playing = TRUE;
+            pipelines_playing++;
+          }
+        break;
+      case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+        g_clear_pointer (&cycle->paused, checkpoint_free);
+        cycle->paused = checkpoint_create (NULL);
+        if (cycle->is_playing)
+          {
+            cycle->is_playing = FALSE;
+            pipelines_playing--;
+          }
+        break;
+      case GST_STATE_CHANGE_READY_TO_NULL:
+        if (cycle->playing != NULL && cycle->paused != NULL)
+          pipeline_cycle_report (name, cycle);
 
-      g_mutex_unlock(&output_mutex);
+        cycle->cycle++;
+        pipeline_cycle_reset (cycle);
+        break;
+      default:
+        break;
     }
 
-  real_g_object_unref (object);
+  gobject_list_unlock ();
 
+  g_free (name);
 }
+#endif
 
-static void *
-get_gst_func (const char *func_name)
+/* Set once the tracer is installed; the hooks below then only have to fix up
+ * the size of buffers. */
+static volatile gboolean mini_object_tracer_active = FALSE;
+
+static void
+tracer_setup (void)
 {
-  static void *handle = NULL;
-  void *func;
-  char *error;
+#ifndef GST_DISABLE_GST_TRACER_HOOKS
+  static gsize once = 0;
 
-  if (G_UNLIKELY (g_once_init_enter (&handle)))
+  if (g_once_init_enter (&once))
     {
-      void *_handle;
+      gpointer (* real_g_object_new) (GType, const char *, ...);
+      GstTracer *tracer;
 
-      _handle = dlopen("libgstreamer-1.0.so.0", RTLD_LAZY);
+      /* The tracer itself is not tracked. It is owned by the tracing
+       * subsystem once the hook is registered. */
+      real_g_object_new = get_func ("g_object_new");
+      tracer = real_g_object_new (gobject_list_tracer_get_type (), NULL);
+      gst_tracing_register_hook (tracer, "mini-object-created",
+          G_CALLBACK (tracer_mini_object_created));
+      if (pipeline_cycles != NULL)
+        gst_tracing_register_hook (tracer, "element-change-state-post",
+            G_CALLBACK (tracer_element_change_state_post));
 
-      if (_handle == NULL)
-        g_error ("Failed to open libgstreamer-1.0.so.0: %s", dlerror ());
+      g_atomic_int_set (&mini_object_tracer_active, TRUE);
 
-      g_once_init_leave (&handle, _handle);
+      g_once_init_leave (&once, 1);
     }
+#endif
+}
 
-  func = dlsym (handle, func_name);
+gboolean
+gst_init_check (int *argc,
+    char **argv[],
+    GError **error)
+{
+  gboolean (* real_gst_init_check) (int *argc, char **argv[], GError **error);
+  gboolean ret;
 
-  if ((error = dlerror ()) != NULL)
-    g_error ("Failed to find symbol: %s", error);
+  real_gst_init_check = get_gst_func ("gst_init_check");
 
-  return func;
+  ret = real_gst_init_check (argc, argv, error);
+  if (ret)
+    tracer_setup ();
+
+  return ret;
+}
+
+void
+gst_init (int *argc,
+    char **argv[])
+{
+  void (* real_gst_init) (int *argc, char **argv[]);
+
+  real_gst_init = get_gst_func ("gst_init");
+
+  /* gst_init() calls gst_init_check() directly, so that one is not seen. */
+  real_gst_init (argc, argv);
+  tracer_setup ();
 }
 
 static gpointer
-new_mini_object(GstMiniObject *mini_object)
+new_buffer (GstBuffer *buffer)
 {
-  G_LOCK (gobject_list);
-  if (display_filter(DISPLAY_FLAG_CREATE) && object_filter(g_type_name(GST_MINI_OBJECT_TYPE(mini_object)))) {
-    GST_ERROR("Created %s(%p)", g_type_name (GST_MINI_OBJECT_TYPE (mini_object)), mini_object);
-    print_trace();
-  }
-  gst_mini_object_weak_ref (mini_object, (GstMiniObjectNotify)_object_finalized, NULL);
+  if (buffer == NULL || !g_atomic_int_get (&tracking_enabled))
+    return buffer;
 
-  g_hash_table_insert (gobject_list_state.objects, mini_object, GUINT_TO_POINTER (TRUE));
-  g_hash_table_insert (gobject_list_state.added, mini_object, GUINT_TO_POINTER (TRUE));
-  G_UNLOCK (gobject_list);
+  if (!g_atomic_int_get (&mini_object_tracer_active))
+    new_mini_object (GST_MINI_OBJECT (buffer));
 
-  return (gpointer) mini_object;
+  /* The memory is only attached after the buffer was initialised */
+  update_mini_object_size (GST_MINI_OBJECT (buffer),
+      sizeof (GstBuffer) + gst_buffer_get_size (buffer));
+
+  return buffer;
 }
 
 GstBuffer *
@@ -508,7 +5075,7 @@ gst_buffer_new (void)
 
     real_gst_buffer_new = get_gst_func("gst_buffer_new");
 
-    return new_mini_object(GST_MINI_OBJECT(real_gst_buffer_new()));
+    return new_buffer(real_gst_buffer_new());
 }
 
 GstBuffer *
@@ -518,7 +5085,7 @@ gst_buffer_new_allocate (GstAllocator * allocator, gsize size,
     GstBuffer * (*real_gst_buffer_new_allocate) (GstAllocator * allocator, gsize size, GstAllocationParams * params);
     real_gst_buffer_new_allocate = get_gst_func("gst_buffer_new_allocate");
 
-    return new_mini_object(GST_MINI_OBJECT(real_gst_buffer_new_allocate (allocator, size, params)));
+    return new_buffer(real_gst_buffer_new_allocate (allocator, size, params));
 }
 
 GstBuffer *
@@ -532,10 +5099,11 @@ gst_buffer_new_wrapped_full (GstMemoryFlags flags, gpointer data,
 
     real_gst_buffer_new_wrapped_full = get_gst_func("gst_buffer_new_wrapped_full");
 
-    return new_mini_object(GST_MINI_OBJECT(real_gst_buffer_new_wrapped_full (flags, data, maxsize, offset, size, user_data, notify)));
+    return new_buffer(real_gst_buffer_new_wrapped_full (flags, data, maxsize, offset, size, user_data, notify));
 }
 
-/* FIXME!!! Why doesn't it override the real function! */
+/* Only reached for mini objects initialised outside of libgstreamer, and only
+ * needed when the tracer could not be installed. */
 void
 gst_mini_object_init (GstMiniObject * mini_object, guint flags, GType type,
     GstMiniObjectCopyFunction copy_func,
@@ -544,29 +5112,39 @@ gst_mini_object_init (GstMiniObject * mini_object, guint flags, GType type,
 {
   void (*real_gst_mini_object_init)(GstMiniObject * mini_object, guint flags, GType type, GstMiniObjectCopyFunction copy_func, GstMiniObjectDisposeFunction dispose_func, GstMiniObjectFreeFunction free_func);
 
-  GST_ERROR("What ze fucking fuck");
   real_gst_mini_object_init = get_gst_func("gst_mini_object_init");
 
-  if (display_filter(DISPLAY_FLAG_CREATE) && object_filter(g_type_name(GST_MINI_OBJECT_TYPE(mini_object)))) {
-      GST_ERROR (" -  create %" GST_PTR_FORMAT " (%p)", mini_object, mini_object);
-      print_trace();
-      gst_mini_object_weak_ref (mini_object, (GstMiniObjectNotify)_object_finalized, NULL);
-
-      g_hash_table_insert (gobject_list_state.objects, mini_object, GUINT_TO_POINTER (TRUE));
-      g_hash_table_insert (gobject_list_state.added, mini_object, GUINT_TO_POINTER (TRUE));
-  }
-
   real_gst_mini_object_init(mini_object, flags, type, copy_func, dispose_func, free_func);
+
+  if (!g_atomic_int_get (&mini_object_tracer_active))
+    new_mini_object (mini_object);
 }
 
 void
 gst_mini_object_unref (GstMiniObject * mini_object)
 {
+  static gpointer real_entry = NULL;
   void (* real_gst_mini_object_unref) (GstMiniObject * mini_object);
+  HookTimer timer;
+
+  real_gst_mini_object_unref = get_cached_func (&real_entry, lookup_gst_func,
+      "gst_mini_object_unref");
+
+  if (G_UNLIKELY (!tracking_enabled))
+    {
+      real_gst_mini_object_unref (mini_object);
+      return;
+    }
+
+  hook_timer_start (&timer);
 
-  real_gst_mini_object_unref = get_gst_func("gst_mini_object_unref");
+  if (G_UNLIKELY (adopt_untracked) && mini_object->refcount > 1)
+    adopt_object (mini_object, GST_MINI_OBJECT_TYPE (mini_object), TRUE);
 
-  if (object_filter (g_type_name(GST_MINI_OBJECT_TYPE (mini_object)))) {
+  if (G_UNLIKELY (trace_refs))
+    trace_ref (mini_object, mini_object->refcount, -1);
+
+  if (record_refs && object_filter (g_type_name(GST_MINI_OBJECT_TYPE (mini_object)))) {
       if (display_filter (DISPLAY_FLAG_REFS)) {
         GST_ERROR (" -  Unrefed %p %" GST_PTR_FORMAT "; ref_count: %d -> %d",
                 mini_object, mini_object, mini_object->refcount, mini_object->refcount + 1);
@@ -574,17 +5152,33 @@ gst_mini_object_unref (GstMiniObject * mini_object)
       }
   }
 
+  hook_timer_stop (&timer, HOOK_MINI_OBJECT_UNREF);
+
   real_gst_mini_object_unref (mini_object);
 }
 
 GstMiniObject *
 gst_mini_object_ref (GstMiniObject * mini_object)
 {
+  static gpointer real_entry = NULL;
   GstMiniObject * (* real_gst_mini_object_ref) (GstMiniObject * mini_object);
+  HookTimer timer;
+
+  real_gst_mini_object_ref = get_cached_func (&real_entry, lookup_gst_func,
+      "gst_mini_object_ref");
+
+  if (G_UNLIKELY (!tracking_enabled))
+    return real_gst_mini_object_ref (mini_object);
+
+  hook_timer_start (&timer);
+
+  if (G_UNLIKELY (adopt_untracked))
+    adopt_object (mini_object, GST_MINI_OBJECT_TYPE (mini_object), TRUE);
 
-  real_gst_mini_object_ref = get_gst_func ("gst_mini_object_ref");
+  if (G_UNLIKELY (trace_refs))
+    trace_ref (mini_object, mini_object->refcount, 1);
 
-  if (object_filter (g_type_name(GST_MINI_OBJECT_TYPE (mini_object)))) {
+  if (record_refs && object_filter (g_type_name(GST_MINI_OBJECT_TYPE (mini_object)))) {
       if (display_filter(DISPLAY_FLAG_REFS)) {
           GST_ERROR(" -  REF %p %" GST_PTR_FORMAT "; ref_count: %d -> %d",
               mini_object, mini_object, mini_object->refcount, mini_object->refcount + 1);
@@ -592,5 +5186,337 @@ gst_mini_object_ref (GstMiniObject * mini_object)
       }
   }
 
+  hook_timer_stop (&timer, HOOK_MINI_OBJECT_REF);
+
   return real_gst_mini_object_ref (mini_object);
 }
+
+static guint64
+count_objects (guint64 serial,
+    GType type)
+{
+  GHashTableIter iter;
+  ObjectInfo *info;
+  guint64 count = 0;
+
+  /* Runs the one-time setup */
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+
+  g_hash_table_iter_init (&iter, gobject_list_state.objects);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &info))
+    {
+      if (object_matches (info, serial, G_MAXUINT64, type))
+        count += info->weight;
+    }
+
+  gobject_list_unlock ();
+
+  return count;
+}
+
+/* The callback is called without the lock held, so that it may use the
+ * objects, which could otherwise call back into the hooks. */
+static void
+foreach_object (guint64 serial,
+    GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data)
+{
+  GArray *objects;
+  guint i;
+
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+  objects = collect_objects (serial, G_MAXUINT64, type);
+  gobject_list_unlock ();
+
+  for (i = 0; i < objects->len; i++)
+    {
+      const ObjectInfo *info = &g_array_index (objects, ObjectInfo, i);
+
+      func (info->obj, info->type->type, user_data);
+    }
+
+  g_array_unref (objects);
+}
+
+GObjectListCheckpoint *
+gobject_list_checkpoint_new (void)
+{
+  GObjectListCheckpoint *checkpoint;
+
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+  checkpoint = checkpoint_create (NULL);
+  gobject_list_unlock ();
+
+  return checkpoint;
+}
+
+void
+gobject_list_checkpoint_free (GObjectListCheckpoint *checkpoint)
+{
+  if (checkpoint == NULL)
+    return;
+
+  /* Saved checkpoints belong to gobject-list */
+  g_return_if_fail (checkpoint->name == NULL);
+
+  checkpoint_free (checkpoint);
+}
+
+const GObjectListCheckpoint *
+gobject_list_checkpoint_save (const gchar *name)
+{
+  GObjectListCheckpoint *checkpoint;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+  checkpoint = checkpoint_save (name);
+  gobject_list_unlock ();
+
+  return checkpoint;
+}
+
+const GObjectListCheckpoint *
+gobject_list_checkpoint_lookup (const gchar *name)
+{
+  const GObjectListCheckpoint *checkpoint = NULL;
+  guint i;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+
+  for (i = saved_checkpoints != NULL ? saved_checkpoints->len : 0; i > 0; i--)
+    {
+      const GObjectListCheckpoint *saved =
+          g_ptr_array_index (saved_checkpoints, i - 1);
+
+      if (strcmp (saved->name, name) == 0)
+        {
+          checkpoint = saved;
+          break;
+        }
+    }
+
+  gobject_list_unlock ();
+
+  return checkpoint;
+}
+
+void
+gobject_list_checkpoint_print_diff (const GObjectListCheckpoint *from,
+    const GObjectListCheckpoint *to)
+{
+  g_return_if_fail (from != NULL);
+
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+  checkpoint_print_diff (from, to);
+  gobject_list_unlock ();
+}
+
+guint64
+gobject_list_checkpoint_count_new (const GObjectListCheckpoint *checkpoint,
+    GType type)
+{
+  g_return_val_if_fail (checkpoint != NULL, 0);
+
+  return count_objects (checkpoint->serial, type);
+}
+
+void
+gobject_list_checkpoint_foreach_new (const GObjectListCheckpoint *checkpoint,
+    GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data)
+{
+  g_return_if_fail (checkpoint != NULL);
+  g_return_if_fail (func != NULL);
+
+  foreach_object (checkpoint->serial, type, func, user_data);
+}
+
+guint64
+gobject_list_checkpoint_dump_new (const GObjectListCheckpoint *checkpoint,
+    GType type)
+{
+  GArray *objects;
+  guint64 count = 0;
+  guint i;
+
+  g_return_val_if_fail (checkpoint != NULL, 0);
+
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+
+  objects = collect_objects (checkpoint->serial, G_MAXUINT64, type);
+
+  g_print ("New objects since checkpoint:\n");
+
+  for (i = 0; i < objects->len; i++)
+    {
+      const ObjectInfo *info = &g_array_index (objects, ObjectInfo, i);
+      GObject *obj = info->obj;
+      StackTrace *stack;
+
+      GST_ERROR (" - %" GST_PTR_FORMAT " (%p) : %u refs%s", obj, obj,
+          obj->ref_count, info->unknown_origin ? " (unknown origin)" : "");
+
+      stack = get_stack (info->stack_id);
+      if (stack != NULL)
+        print_stack (stack);
+
+      count += info->weight;
+    }
+
+  g_print ("%" G_GUINT64_FORMAT " objects\n", count);
+
+  gobject_list_unlock ();
+
+  g_array_unref (objects);
+
+  return count;
+}
+
+guint64
+gobject_list_get_live_count (GType type)
+{
+  return count_objects (0, type);
+}
+
+void
+gobject_list_foreach (GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data)
+{
+  g_return_if_fail (func != NULL);
+
+  foreach_object (0, type, func, user_data);
+}
+
+void
+gobject_list_set_enabled (gboolean enabled)
+{
+  /* Runs the one-time setup, including hook_setup() */
+  get_func ("g_object_new");
+
+  tracking_set_enabled (enabled);
+}
+
+gboolean
+gobject_list_is_enabled (void)
+{
+  return g_atomic_int_get (&tracking_enabled);
+}
+
+void
+gobject_list_arm (void)
+{
+  get_func ("g_object_new");
+
+  gobject_list_lock ();
+  arm ("API call");
+  gobject_list_unlock ();
+}
+
+gboolean
+gobject_list_is_armed (void)
+{
+  return g_atomic_int_get (&armed);
+}
+
+/* Count the live instances of @type and its descendants into their
+ * TypeStats. GLib only keeps these counts when GOBJECT_DEBUG=instance-count
+ * was set at startup. Must be called with the gobject_list lock held. */
+static void
+attach_count_instances (GType type)
+{
+  GType *children;
+  guint n_children, i;
+  gint count;
+
+  count = g_type_get_instance_count (type);
+  if (count > 0)
+    {
+      TypeStats *stats = get_type_stats (type);
+
+      stats->attached = count;
+      attached_objects += count;
+    }
+
+  children = g_type_children (type, &n_children);
+  for (i = 0; i < n_children; i++)
+    attach_count_instances (children[i]);
+  g_free (children);
+}
+
+/* Start tracking in a process which did not load gobject-list with
+ * LD_PRELOAD. Called by gobject-list-attach once it has loaded the library
+ * into the process; settings are taken from the process’ environment. Calls
+ * to the tracked functions are intercepted by GOT rewriting, in addition to
+ * any GOBJECT_LIST_HOOK setting, and only objects created from now on are
+ * tracked. */
+void
+gobject_list_attach (void)
+{
+  /* Runs the one-time setup, including hook_setup(), unless something
+   * already created an object through the library since it was loaded */
+  attaching = TRUE;
+  get_func ("g_object_new");
+
+  hook_modes |= HOOK_MODE_GOT;
+
+  if (!gobject_list_got_install (got_hooks, G_N_ELEMENTS (got_hooks)))
+    g_warning ("GOT rewriting is not supported on this platform; only "
+        "mini objects can be tracked");
+
+  g_atomic_int_set (&tracking_enabled, TRUE);
+
+  if (gst_is_initialized ())
+    tracer_setup ();
+
+  gobject_list_lock ();
+
+  attached_objects = 0;
+  attach_count_instances (G_TYPE_OBJECT);
+
+  g_print ("gobject-list attached to %d", getpid ());
+  if (attached_objects > 0)
+    g_print ("; %" G_GUINT64_FORMAT " objects already alive are not tracked",
+        attached_objects);
+  g_print ("\n");
+
+  gobject_list_unlock ();
+}
+
+/* Stop tracking new objects and restore every patched GOT entry and function
+ * entry. The library must stay loaded: tracked objects still hold weak
+ * references pointing into it. The objects created since attaching which are
+ * still alive are printed. */
+void
+gobject_list_detach (void)
+{
+  g_atomic_int_set (&tracking_enabled, FALSE);
+
+  hooks_uninstall ();
+  hook_modes = 0;
+
+  g_print ("\nStill alive since attaching to %d:\n", getpid ());
+
+  gobject_list_lock ();
+  _dump_object_list (gobject_list_state.objects);
+  gobject_list_unlock ();
+}
@@ -0,0 +1,151 @@
+/*
+ * gobject-list: a LD_PRELOAD library for tracking the lifetime of GObjects
+ *
+ * Copyright (C) 2011, 2014  Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+/* Public interface of libgobject-list, for applications and test suites
+ * which want to query the tracked objects directly rather than through
+ * signals and the log.
+ *
+ * As the library is normally loaded with LD_PRELOAD, code using it should not
+ * link to it but look the functions up at runtime, so that it still runs
+ * without it:
+ *
+ *   GObjectListCheckpointNewFunc checkpoint_new =
+ *       dlsym (RTLD_DEFAULT, "gobject_list_checkpoint_new");
+ *
+ * Every count is an estimate when sampling with GOBJECT_LIST_SAMPLE. */
+
+#ifndef GOBJECT_LIST_H
+#define GOBJECT_LIST_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* A point in time; objects tracked after it are new to it. Checkpoints are
+ * independent of each other, and saving one clears nothing. */
+typedef struct _GObjectListCheckpoint GObjectListCheckpoint;
+
+/* Called for a tracked object of @type. The object is only guaranteed to be
+ * alive if the caller otherwise knows it is. */
+typedef void (* GObjectListForeachFunc) (gpointer object,
+    GType type,
+    gpointer user_data);
+
+GObjectListCheckpoint *gobject_list_checkpoint_new (void);
+/* Must not be called on saved checkpoints */
+void gobject_list_checkpoint_free (GObjectListCheckpoint *checkpoint);
+
+/* Save a checkpoint under @name; it stays valid until exit. Saving again
+ * under the same name keeps the earlier one, but
+ * gobject_list_checkpoint_lookup() then returns the latest. SIGUSR2 also
+ * saves checkpoints, named ‘usr2-1’, ‘usr2-2’…, of which only the last four
+ * are kept: older ones are freed. */
+const GObjectListCheckpoint *gobject_list_checkpoint_save (const gchar *name);
+const GObjectListCheckpoint *gobject_list_checkpoint_lookup (
+    const gchar *name);
+
+/* Print the number of objects of each type created and finalized between
+ * @from and @to, in either order, or now if @to is NULL, then the objects
+ * created in between which are still alive. */
+void gobject_list_checkpoint_print_diff (const GObjectListCheckpoint *from,
+    const GObjectListCheckpoint *to);
+
+/* Number of objects tracked since @checkpoint which are still alive, and of
+ * @type or one of its subtypes. G_TYPE_INVALID matches every type. */
+guint64 gobject_list_checkpoint_count_new (
+    const GObjectListCheckpoint *checkpoint,
+    GType type);
+
+/* Call @func for each object counted by gobject_list_checkpoint_count_new(),
+ * in creation order. */
+void gobject_list_checkpoint_foreach_new (
+    const GObjectListCheckpoint *checkpoint,
+    GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data);
+
+/* Print the objects counted by gobject_list_checkpoint_count_new() as
+ * SIGUSR1 does, with their creation stacks if recorded, and return their
+ * number. */
+guint64 gobject_list_checkpoint_dump_new (
+    const GObjectListCheckpoint *checkpoint,
+    GType type);
+
+/* Number of tracked objects alive of @type or one of its subtypes;
+ * G_TYPE_INVALID matches every type. */
+guint64 gobject_list_get_live_count (GType type);
+
+/* Call @func for each tracked object alive, as
+ * gobject_list_checkpoint_foreach_new(). */
+void gobject_list_foreach (GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data);
+
+/* Switch tracking off, leaving only the cost of a check in each hook and
+ * restoring anything patched for GOBJECT_LIST_HOOK, or back on, which starts a
+ * new SIGUSR2 checkpoint. Objects tracked before keep being tracked until
+ * finalized. */
+void gobject_list_set_enabled (gboolean enabled);
+gboolean gobject_list_is_enabled (void);
+
+/* Start tracking objects individually, if GOBJECT_LIST_ARM delayed it. This
+ * also saves a checkpoint named ‘armed’. */
+void gobject_list_arm (void);
+gboolean gobject_list_is_armed (void);
+
+/* Used by gobject-list-attach; see gobject-list.c. */
+void gobject_list_attach (void);
+void gobject_list_detach (void);
+
+/* Types of the above, for use with dlsym() */
+typedef GObjectListCheckpoint * (* GObjectListCheckpointNewFunc) (void);
+typedef void (* GObjectListCheckpointFreeFunc) (
+    GObjectListCheckpoint *checkpoint);
+typedef const GObjectListCheckpoint * (* GObjectListCheckpointSaveFunc) (
+    const gchar *name);
+typedef const GObjectListCheckpoint * (* GObjectListCheckpointLookupFunc) (
+    const gchar *name);
+typedef void (* GObjectListCheckpointPrintDiffFunc) (
+    const GObjectListCheckpoint *from,
+    const GObjectListCheckpoint *to);
+typedef guint64 (* GObjectListCheckpointCountNewFunc) (
+    const GObjectListCheckpoint *checkpoint,
+    GType type);
+typedef void (* GObjectListCheckpointForeachNewFunc) (
+    const GObjectListCheckpoint *checkpoint,
+    GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data);
+typedef guint64 (* GObjectListCheckpointDumpNewFunc) (
+    const GObjectListCheckpoint *checkpoint,
+    GType type);
+typedef guint64 (* GObjectListGetLiveCountFunc) (GType type);
+typedef void (* GObjectListForeachAllFunc) (GType type,
+    GObjectListForeachFunc func,
+    gpointer user_data);
+typedef void (* GObjectListSetEnabledFunc) (gboolean enabled);
+typedef gboolean (* GObjectListIsEnabledFunc) (void);
+typedef void (* GObjectListArmFunc) (void);
+typedef gboolean (* GObjectListIsArmedFunc) (void);
+
+G_END_DECLS
+
+#endif /* GOBJECT_LIST_H */